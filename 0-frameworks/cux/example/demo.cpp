@@ -2,16 +2,20 @@
 
 ////////////
 // Plugins.
+#ifndef CUX_CPU_ONLY
 extern cux::KernelInterface *DotProductGPUPlugin();
 extern cux::KernelInterface *GemmGPUPlugin();
+#endif
 
 void DotProductTest() {
   cux::Executor *executor = new cux::Executor();
   executor->Initialize(0);
   executor->SelectOp("dot", "");
 
+#ifndef CUX_CPU_ONLY
   // Add a user-defined kernel to the selected op.
   executor->AddPlugin(DotProductGPUPlugin(), cux::OpRunMode::ON_DEVICE);
+#endif
 
   // Data preparation.
   // Too large a value may cause overflow.
@@ -31,7 +35,9 @@ void DotProductTest() {
 
   // Run.
   executor->Run(cux::OpRunMode::ON_HOST);
+#ifndef CUX_CPU_ONLY
   executor->Run(cux::OpRunMode::ON_DEVICE);
+#endif
 
   delete in_a;
   delete in_b;
@@ -62,7 +68,9 @@ void Nrm2Test() {
 
   // Run.
   executor->Run(cux::OpRunMode::ON_HOST);
+#ifndef CUX_CPU_ONLY
   executor->Run(cux::OpRunMode::ON_DEVICE);
+#endif
 
   delete in;
   delete out;
@@ -76,8 +84,10 @@ void GEMMTest() {
   executor->Initialize(0);
   executor->SelectOp("gemm", "alpha: 1.0, beta: 3.0");
 
+#ifndef CUX_CPU_ONLY
   // Add a user-defined kernel to the selected op.
   executor->AddPlugin(GemmGPUPlugin(), cux::OpRunMode::ON_DEVICE);
+#endif
 
   // Data preparation.
   int block_size = 32;
@@ -98,8 +108,10 @@ void GEMMTest() {
   
   // Run.
   executor->Run(cux::OpRunMode::ON_HOST);
+#ifndef CUX_CPU_ONLY
   out_c->Restore(cux::TypeFlag::FLOAT32, cux::ON_HOST); // For beta in gemm.
   executor->Run(cux::OpRunMode::ON_DEVICE);
+#endif
 
   delete in_a;
   delete in_b;
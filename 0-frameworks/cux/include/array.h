@@ -6,6 +6,7 @@
 #define CUX_ARRAY4D_H_
 
 #include <vector>
+#include <string.h>
 #include "util/util.h"
 #include "util/data_filler.h"
 
@@ -22,13 +23,16 @@ public:
 
   ~Array4DBackup() {
     if (cpu_data_ != nullptr) {
-      delete[]cpu_data_;
+      // It is created by type, a void* can not be deleted.
+      TYPE_SWITCH(type_flag_, T, delete[](T *)cpu_data_;);
       cpu_data_ = nullptr;
     }
+#ifndef CUX_CPU_ONLY
     if (gpu_data_ != nullptr) {
       cudaFree(gpu_data_);
       gpu_data_ = nullptr;
     }
+#endif
   }
   inline int type_flag() { return type_flag_; }
   inline bool is_cpu_data_empty() { return cpu_data_ == nullptr ? true : false; }
@@ -49,16 +53,24 @@ public:
   }
   // Save and restore data on device.
   void SaveGpuData(const void *gpu_data, const int num_element) {
+#ifdef CUX_CPU_ONLY
+    CUXLOG_ERR("SaveGpuData -> cux is built without CUDA.");
+#else
     if (gpu_data_ == nullptr) {
       CUDA_CHECK(cudaMalloc(&gpu_data_, element_size_ * num_element));
     }
     CUDA_CHECK(cudaMemcpy(gpu_data_, gpu_data, element_size_ * num_element, cudaMemcpyDeviceToDevice));
+#endif
   }
   void RestoreGpuData(void *gpu_data, int &num_element) {
+#ifdef CUX_CPU_ONLY
+    CUXLOG_ERR("RestoreGpuData -> cux is built without CUDA.");
+#else
     if (gpu_data_ == nullptr) {
       CUXLOG_ERR("RestoreGpuData -> The data has not been saved. Please check again.");
     }
     CUDA_CHECK(cudaMemcpy(gpu_data, gpu_data_, element_size_ * num_element, cudaMemcpyDeviceToDevice));
+#endif
   }
 public:
   // Backup.
@@ -92,13 +104,19 @@ public:
     }
     bool is_push = (mode == PUSH || (mode == PUSH_IF_EMPTY && is_create));
     if (is_push && gpu_data_[type_flag] != nullptr) {
+#ifndef CUX_CPU_ONLY
       CUDA_CHECK(cudaMemcpy(cpu_data_[type_flag], gpu_data_[type_flag], num_element_ * sizeof(DType), cudaMemcpyDeviceToHost));
+#endif
     }
     return static_cast<DType*>(cpu_data_[type_flag]);
   }
 
   template<typename DType>
   DType* GetGpuData(DataFetchMode mode = NO_PUSH) {
+#ifdef CUX_CPU_ONLY
+    CUXLOG_ERR("GetGpuData -> cux is built without CUDA.");
+    return nullptr;
+#else
     int type_flag = cux::DataType<DType>::kFlag;
 
     bool is_create = false;
@@ -111,6 +129,7 @@ public:
       CUDA_CHECK(cudaMemcpy(gpu_data_[type_flag], cpu_data_[type_flag], num_element_ * sizeof(DType), cudaMemcpyHostToDevice));
     }
     return static_cast<DType*>(gpu_data_[type_flag]);
+#endif
   }
 
   // decimal_pose: 0 for generating integers. 1 for x.x, 2 for x.xx, and etc.
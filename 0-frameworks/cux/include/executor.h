@@ -15,7 +15,7 @@
 
 namespace cux {
 
-static void InitEnvironment() {
+inline void InitEnvironment() {
   CUXLOG_INFO("Initialize Environment.");
 
   OpFactory::GetInstance().RegisterOpClass("dot", Dot::Creator);
@@ -26,8 +26,9 @@ static void InitEnvironment() {
   CUXLOG_COUT("");
 }
 
-static void CleanUpEnvironment() {
+inline void CleanUpEnvironment() {
   CUXLOG_INFO("Cleanup Environment.");
+#ifndef CUX_CPU_ONLY
   // Reset the device and exit
   // cudaDeviceReset causes the driver to clean up all state. While
   // not mandatory in normal operation, it is good practice.  It is also
@@ -35,9 +36,13 @@ static void CleanUpEnvironment() {
   // profiled. Calling cudaDeviceReset causes all profile data to be
   // flushed before the application exits
   CUDA_CHECK(cudaDeviceReset());
+#endif
 }
 
-static void QueryDevices() {
+inline void QueryDevices() {
+#ifdef CUX_CPU_ONLY
+  CUXLOG_COUT("-- Built without CUDA, there is no device to query.");
+#else
   int device_count = 0;
   CUDA_CHECK(cudaGetDeviceCount(&device_count));
 
@@ -69,11 +74,12 @@ static void QueryDevices() {
     CUXLOG_COUT("***");
   }
   CUXLOG_COUT("-------------------------------------------------");
+#endif
 }
 
 class Executor {
 public:
-  Executor() :op_(nullptr), op_assistor_(nullptr) {}
+  Executor() :op_assistor_(nullptr), op_(nullptr) {}
 
   void Initialize(const int dev_id);
 
@@ -28,18 +28,20 @@ public:
   Gemm(OpAssistor *assistor, GemmKernelParam &params) :Operator(assistor) {
     params_ = params;
     CpuKernelsSetup();
+#ifndef CUX_CPU_ONLY
     GpuKernelsSetup();
+#endif
     ResetByKernelNum(cpu_kernels_.size(), gpu_kernels_.size());
   }
   ~Gemm() {
-    for (int i = 0; i < cpu_kernels_.size(); i++) {
+    for (int i = 0; i < (int)cpu_kernels_.size(); i++) {
       delete cpu_kernels_[i];
     }
-    for (int i = 0; i < gpu_kernels_.size(); i++) {
+    for (int i = 0; i < (int)gpu_kernels_.size(); i++) {
       delete gpu_kernels_[i];
     }
   }
-  static Operator *Gemm::Creator(OpAssistor *assistor, std::string &params_str);
+  static Operator *Creator(OpAssistor *assistor, std::string &params_str);
 
   void Help() const;
   void AddPlugin(KernelInterface *kernel_if, OpRunMode mode);
@@ -47,8 +49,10 @@ public:
 
   void RunOnHost(const std::vector< Array4D* > &input,
                  const std::vector< Array4D* > &output);
+#ifndef CUX_CPU_ONLY
   void RunOnDevice(const std::vector< Array4D* > &input,
                    const std::vector< Array4D* > &output);
+#endif
 
 private:
   void IoCheckAndSet(const std::vector< Array4D* > &input,
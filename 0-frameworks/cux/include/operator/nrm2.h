@@ -16,18 +16,20 @@ class Nrm2 : public Operator {
 public:
   Nrm2(OpAssistor *assistor) :Operator(assistor) {
     CpuKernelsSetup();
+#ifndef CUX_CPU_ONLY
     GpuKernelsSetup();
+#endif
     ResetByKernelNum(cpu_kernels_.size(), gpu_kernels_.size());
   }
   ~Nrm2() {
-    for (int i = 0; i < cpu_kernels_.size(); i++) {
+    for (int i = 0; i < (int)cpu_kernels_.size(); i++) {
       delete cpu_kernels_[i];
     }
-    for (int i = 0; i < gpu_kernels_.size(); i++) {
+    for (int i = 0; i < (int)gpu_kernels_.size(); i++) {
       delete gpu_kernels_[i];
     }
   }
-  static Operator *Nrm2::Creator(OpAssistor *op_assistor, std::string &params_str);
+  static Operator *Creator(OpAssistor *op_assistor, std::string &params_str);
   
   void Help() const;
   void AddPlugin(KernelInterface *kernel_if, OpRunMode mode);
@@ -35,8 +37,10 @@ public:
 
   void RunOnHost(const std::vector< Array4D* > &input,
                  const std::vector< Array4D* > &output);
+#ifndef CUX_CPU_ONLY
   void RunOnDevice(const std::vector< Array4D* > &input,
                    const std::vector< Array4D* > &output);
+#endif
 
 private:
   void IoCheckAndSet(const std::vector< Array4D* > &input,
@@ -99,6 +99,9 @@ private:
 // This class is used to assist operators.
 class OpAssistor {
 public:
+#ifdef CUX_CPU_ONLY
+  OpAssistor(Device *device) : device_(device) {
+#else
   OpAssistor(Device *device)
     : device_(device), cublas_handle_(nullptr), launch_config_(nullptr){
     if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
@@ -108,12 +111,14 @@ public:
     if (launch_config_ == nullptr) {
       CUXLOG_ERR("Cannot new a LaunchConfig.");
     }
+#endif
     checker_ = new ResultChecker();
     if (checker_ == nullptr) {
       CUXLOG_ERR("Cannot new a checker_.");
     }
   }
   ~OpAssistor() {
+#ifndef CUX_CPU_ONLY
     if (cublas_handle_ != nullptr) {
       cublasDestroy(cublas_handle_);
       cublas_handle_ = nullptr;
@@ -122,22 +127,27 @@ public:
       delete launch_config_;
       launch_config_ = nullptr;
     }
+#endif
     if (checker_ != nullptr) {
       delete checker_;
       checker_ = nullptr;
     }
   }
   inline Device *device() { return device_; }
+#ifndef CUX_CPU_ONLY
   inline cublasHandle_t cublas_handle() { return cublas_handle_; }
   inline LaunchConfig *launch_config() { return launch_config_; }
+#endif
   inline ResultChecker *checker() { return checker_; }
 
 private:
   Device *device_;
 
+#ifndef CUX_CPU_ONLY
   cublasHandle_t cublas_handle_;
   // Generate kernel launch config and Get occupancy.
   LaunchConfig *launch_config_;
+#endif
   // Verify the correctness of the output.
   ResultChecker *checker_;
 };
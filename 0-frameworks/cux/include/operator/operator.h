@@ -27,9 +27,12 @@ struct KernelTimeRecord {
 class Operator {
 public:
   Operator(OpAssistor *assistor) : assistor_(assistor) {}
+  virtual ~Operator() {}
 
+#ifndef CUX_CPU_ONLY
   void QueryPotentialOccupancy(const void *config_kernel, int kernel_id, 
                                int threads_per_block, int shared_memory_size);
+#endif
 
   void PrintRecordedInfo(const OpRunMode &mode, int kernel_id, const KernelInterface *kernel_info);
   void ResetByKernelNum(int cpu_kernel_num, int gpu_kernel_num);
@@ -43,8 +46,16 @@ public:
   // Run.
   virtual void RunOnHost(const std::vector< Array4D* > &input,
                          const std::vector< Array4D* > &output) = 0;
+#ifdef CUX_CPU_ONLY
+  // There is no device to run on in a host-only build.
+  virtual void RunOnDevice(const std::vector< Array4D* > &input,
+                           const std::vector< Array4D* > &output) {
+    CUXLOG_ERR("cux is built without CUDA (CUX_USE_CUDA=OFF), only ON_HOST is available.");
+  }
+#else
   virtual void RunOnDevice(const std::vector< Array4D* > &input,
                            const std::vector< Array4D* > &output) = 0;
+#endif
 
 private:
   // Set the input and output data.
@@ -55,7 +66,9 @@ public:
   // It is owned by Executor and provides content that each op can share.
   OpAssistor *assistor_;
   
+#ifndef CUX_CPU_ONLY
   GpuTimer gpu_timer_;
+#endif
   CpuTimer cpu_timer_;
   std::vector<KernelTimeRecord> cpu_timer_record_;
   std::vector<KernelTimeRecord> gpu_timer_record_;
@@ -6,6 +6,7 @@
 #define CUX_DATA_FILLER_H_
 
 #include <iostream>
+#include <string.h>
 #include <time.h>
 
 namespace cux { 
@@ -16,7 +17,7 @@ class DataFiller {
 public:
   template <typename DType>
   static void ZeroFill(int len, DType *arr) {
-    memset(arr, 0, sizeof(DType) * len);
+    memset((void *)arr, 0, sizeof(DType) * len);
   }
 
   template <typename DType>
@@ -43,7 +43,10 @@
 #define CUX_FP16_H_
 
 #include <iostream>
+#include <stdint.h>
+#ifndef CUX_CPU_ONLY
 #include <cuda_fp16.h>
+#endif
 
 // This flag dictates rounding for the float2half() routine only (used generally on Windows),
 // not the f16c lib or cuda v7.5 (or later) behavior which is fixed at round-to-nearest-even.
@@ -80,7 +83,9 @@ class alignas(2) half {
 public:
   union {
     uint16_t half_;
+#ifndef CUX_CPU_ONLY
     __half cuhalf_;
+#endif
   };
 
   static inline half Binary(uint16_t value) {
@@ -97,7 +102,9 @@ public:
   inline explicit half(const int32_t& value) { constructor(value); }
   inline explicit half(const uint32_t& value) { constructor(value); }
 
+#ifndef CUX_CPU_ONLY
   inline explicit half(const __half& value) { cuhalf_ = value; }
+#endif
   inline operator float() { return float(half2float(half_));}
 
   // Operator overloading.
@@ -41,6 +41,7 @@ struct Config3D {
   int shared_memory_size = 0;
 };
 
+#ifndef CUX_CPU_ONLY
 // Mainly used for automatic generation of config for kernels.
 class LaunchConfig {
 public:
@@ -177,6 +178,7 @@ private:
 private:
   Device *device_;
 };
+#endif // CUX_CPU_ONLY
 
 }	//namespace cux
 #endif //CUX_LAUNCH_CONFIG_H_
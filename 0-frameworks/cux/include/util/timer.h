@@ -12,6 +12,7 @@
 
 namespace cux {
 
+#ifndef CUX_CPU_ONLY
 // Timer for gpu.
 class GpuTimer {
 public:
@@ -36,6 +37,7 @@ protected:
   cudaEvent_t start_;
   cudaEvent_t stop_;
 };
+#endif // CUX_CPU_ONLY
 
 // Timer for cpu.
 class CpuTimer {
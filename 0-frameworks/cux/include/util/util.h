@@ -8,9 +8,11 @@
 #include <iostream>
 #include <chrono>
 
+#ifndef CUX_CPU_ONLY
 #include <cuda_runtime.h>
 #include "device_launch_parameters.h"
 #include <cublas_v2.h>
+#endif
 
 #include "util/half.h"
 
@@ -48,7 +50,9 @@ enum DataFetchMode {
 ////////////////
 // Function.
 ////////////////
+#ifndef CUX_CPU_ONLY
 const char* CublasGetErrorString(cublasStatus_t error);
+#endif
 
 ////////////////
 // Class.
@@ -65,6 +69,7 @@ public:
 ////////////////
 // Macro.
 ////////////////
+#ifndef CUX_CPU_ONLY
 // Check for cuda error messages.
 #define CUDA_CHECK(condition) \
   do { \
@@ -86,16 +91,17 @@ public:
 		  exit(EXIT_FAILURE);	\
 	  } \
   } while (0)
+#endif // CUX_CPU_ONLY
 
 // Log
 #define CUXLOG_ERR(format, ...) \
   do { \
-    fprintf(stderr,"[ERROR]: (%s: %d)"##format"\n", __FILE__, __LINE__, ##__VA_ARGS__); \
+    fprintf(stderr,"[ERROR]: (%s: %d)" format "\n", __FILE__, __LINE__, ##__VA_ARGS__); \
     std::abort(); \
   } while(0)
-#define CUXLOG_WARN(format, ...) fprintf(stdout,"[WARN]: "##format"\n", ##__VA_ARGS__);
-#define CUXLOG_INFO(format, ...) fprintf(stdout,"[INFO]: "##format"\n", ##__VA_ARGS__);
-#define CUXLOG_COUT(format, ...) fprintf(stdout,"> "##format"\n", ##__VA_ARGS__);
+#define CUXLOG_WARN(format, ...) fprintf(stdout,"[WARN]: " format "\n", ##__VA_ARGS__);
+#define CUXLOG_INFO(format, ...) fprintf(stdout,"[INFO]: " format "\n", ##__VA_ARGS__);
+#define CUXLOG_COUT(format, ...) fprintf(stdout,"> " format "\n", ##__VA_ARGS__);
 
 #define INSTANTIATE_CLASS(classname) \
   char gInstantiationGuard##classname; \
@@ -139,9 +145,20 @@ public:
 ////////////////
 // Struct.
 ////////////////
+#ifdef CUX_CPU_ONLY
+// Stands in for the one of cuda in a host-only build, so that the
+// launch configs of the device kernels can still be declared.
+struct dim3 {
+  unsigned int x, y, z;
+  dim3(unsigned int vx = 1, unsigned int vy = 1, unsigned int vz = 1) : x(vx), y(vy), z(vz) {}
+};
+#endif
+
 struct Device {
   int id;
+#ifndef CUX_CPU_ONLY
   cudaDeviceProp prop;
+#endif
 };
 
 // Get type flag from type.
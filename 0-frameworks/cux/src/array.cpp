@@ -29,13 +29,15 @@ Array4D::Array4D(int num, int channels, int height, int width) {
 Array4D::~Array4D() {
   for (int i = 0; i < TypeFlag::TYPES_NUM; i++) {
     if (cpu_data_[i] != nullptr) {
-      delete[]cpu_data_[i];
+      TYPE_SWITCH(i, T, delete[](T *)cpu_data_[i];);
       cpu_data_[i] = nullptr;
     }
+#ifndef CUX_CPU_ONLY
     if (gpu_data_[i] != nullptr) {
       cudaFree(gpu_data_[i]);
       gpu_data_[i] = nullptr;
     }
+#endif
     if (backup_[i] != nullptr) {
       delete backup_[i];
       backup_[i] = nullptr;
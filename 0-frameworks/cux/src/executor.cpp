@@ -10,11 +10,13 @@ namespace cux {
 void Executor::Initialize(const int dev_id) {
   device_.id = dev_id;
 
+#ifndef CUX_CPU_ONLY
   CUDA_CHECK(cudaSetDevice(device_.id));
   CUDA_CHECK(cudaGetDeviceProperties(&device_.prop, device_.id));
   if (device_.prop.computeMode == cudaComputeModeProhibited) {
     CUXLOG_ERR("Device (%d) is running in <Compute Mode Prohibited>, no threads can use ::cudaSetDevice().", dev_id);
   }
+#endif
 
   op_assistor_ = new OpAssistor(&device_);
   if (op_assistor_ == nullptr)
@@ -54,9 +56,9 @@ void Executor::BindAndFill(const std::vector< Array4D* > &inputs,
   outputs_.assign(outputs.begin(), outputs.end());
 
   // Fill.
-  for (int i = 0; i < inputs_.size(); i++)
+  for (int i = 0; i < (int)inputs_.size(); i++)
     inputs_[i]->Fill(min_value, max_value, decimal_pose, TypeFlag::FLOAT32, OpRunMode::ON_HOST);
-  for (int i = 0; i < outputs_.size(); i++)
+  for (int i = 0; i < (int)outputs_.size(); i++)
     outputs_[i]->Fill(min_value, max_value, decimal_pose, TypeFlag::FLOAT32, OpRunMode::ON_HOST);
 
   // Data synchronization across types.
@@ -64,14 +66,14 @@ void Executor::BindAndFill(const std::vector< Array4D* > &inputs,
   op_->ExtractDataTypes(type_flags);
 
   TYPE_SWITCH(TypeFlag::FLOAT32, FP32, {
-    for (int type = 0; type < type_flags.size(); type++) {
+    for (int type = 0; type < (int)type_flags.size(); type++) {
       if (type == TypeFlag::FLOAT32 || type_flags[type] == 0) {
         continue;
       }
       TYPE_SWITCH(type, DstType, {
-        for (int i = 0; i < inputs_.size(); i++)
+        for (int i = 0; i < (int)inputs_.size(); i++)
           inputs_[i]->PrecsCpuCvt<FP32, DstType>();
-        for (int i = 0; i < outputs_.size(); i++)
+        for (int i = 0; i < (int)outputs_.size(); i++)
           outputs_[i]->PrecsCpuCvt<FP32, DstType>();
       });
     }
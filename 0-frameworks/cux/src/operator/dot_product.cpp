@@ -1,4 +1,7 @@
 #include "operator/dot_product.h"
+#ifdef CUX_X86_SIMD
+#include <immintrin.h>
+#endif
 
 namespace cux {
   
@@ -12,6 +15,7 @@ void DotHostV0(int len, const float *vec_a, const float *vec_b, float *res) {
   *res = temp;
 }
 
+#ifdef CUX_X86_SIMD
 // Kernel V1
 // SIMD.
 void DotHostV1(int len, const float *vec_a, const float *vec_b, float *res) {
@@ -29,7 +33,9 @@ void DotHostV1(int len, const float *vec_a, const float *vec_b, float *res) {
 
       sum = _mm_add_ps(sum, _mm_add_ps(_mm_mul_ps(a0, b0), _mm_mul_ps(a1, b1)));
     }
-    result = sum.m128_f32[0] + sum.m128_f32[1] + sum.m128_f32[2] + sum.m128_f32[3];
+    float sum4[4];
+    _mm_storeu_ps(sum4, sum);
+    result = sum4[0] + sum4[1] + sum4[2] + sum4[3];
   }
 
   // Calculate the remaining part.
@@ -38,6 +44,7 @@ void DotHostV1(int len, const float *vec_a, const float *vec_b, float *res) {
   }
   *res = result;
 }
+#endif // CUX_X86_SIMD
 
 //////////////////////
 void Dot::CpuKernelsSetup() {
@@ -55,6 +62,7 @@ void Dot::CpuKernelsSetup() {
 
     cpu_kernels_.push_back(kernel);
   }
+#ifdef CUX_X86_SIMD
   // Kernel v1.
   {
     auto func = [&](int len, const void *vec_a, const void *vec_b, void *res) -> void {
@@ -68,6 +76,7 @@ void Dot::CpuKernelsSetup() {
 
     cpu_kernels_.push_back(kernel);
   }
+#endif // CUX_X86_SIMD
 }
 
 //////////////////////
@@ -115,13 +124,13 @@ void Dot::AddPlugin(KernelInterface *kernel_if, OpRunMode mode) {
 void Dot::ExtractDataTypes(std::vector<int>& type_flags) {
   type_flags.clear();
   type_flags.resize(TYPES_NUM);
-  for (int i = 0; i < type_flags.size(); i++) {
+  for (int i = 0; i < (int)type_flags.size(); i++) {
     type_flags[i] = 0;
   }
-  for (int i = 0; i < cpu_kernels_.size(); i++) {
+  for (int i = 0; i < (int)cpu_kernels_.size(); i++) {
     type_flags[cpu_kernels_[i]->type_flag] = 1;
   }
-  for (int i = 0; i < gpu_kernels_.size(); i++) {
+  for (int i = 0; i < (int)gpu_kernels_.size(); i++) {
     type_flags[gpu_kernels_[i]->type_flag] = 1;
   }
 }
@@ -133,7 +142,7 @@ void Dot::RunOnHost(const std::vector< Array4D* > &input,
   IoCheckAndSet(input, output);
 
   const int len = in_a_->num_element();
-  for (int ki = 0; ki < cpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)cpu_kernels_.size(); ki++) {
     DotCpuKernelIF *kernel = cpu_kernels_[ki];
 
     // Input.
@@ -157,20 +166,21 @@ void Dot::RunOnHost(const std::vector< Array4D* > &input,
     );
   }
   // Show.
-  for (int ki = 0; ki < cpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)cpu_kernels_.size(); ki++) {
     PrintRecordedInfo(OpRunMode::ON_HOST, ki, cpu_kernels_[ki]);
   }
 }
 
 //////////////////
 // cuda version.
+#ifndef CUX_CPU_ONLY
 void Dot::RunOnDevice(const std::vector< Array4D* > &input,
                       const std::vector< Array4D* > &output) {
   CUXLOG_COUT("Dot -> GPU:");
   IoCheckAndSet(input, output);
 
   const int len = in_a_->num_element();
-  for (int ki = 0; ki < gpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)gpu_kernels_.size(); ki++) {
     DotGpuKernelIF *kernel = gpu_kernels_[ki];
     Config1D config = kernel->get_config(len);
 
@@ -208,9 +218,10 @@ void Dot::RunOnDevice(const std::vector< Array4D* > &input,
     );
   }
   // Show.
-  for (int ki = 0; ki < gpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)gpu_kernels_.size(); ki++) {
     PrintRecordedInfo(OpRunMode::ON_DEVICE, ki, gpu_kernels_[ki]);
   }
 }
+#endif // CUX_CPU_ONLY
 
 }
\ No newline at end of file
@@ -2,6 +2,9 @@
 * \brief gemm: C = A * B.
 */
 #include "operator/gemm.h"
+#ifdef CUX_X86_SIMD
+#include <immintrin.h>
+#endif
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -57,6 +60,7 @@ void GemmHostV1(const int M, const int N,
   }
 }
 
+#ifdef CUX_X86_SIMD
 // Kernel V2
 // A simple version using simd based on V1.
 void GemmHostV2(const int M, const int N,
@@ -216,6 +220,7 @@ void GemmHostV4(const int M, const int N,
     }
   }
 }
+#endif // CUX_X86_SIMD
 
 // Kernel V5
 // Block-based matrix multiplication in cpu.
@@ -225,12 +230,8 @@ void GemmHostV5(const int M, const int N,
                 const float *B, const int ldb,
                 const float beta,
                 float *C, const int ldc) {
-  int bi, bj, bk;
   int i, j, k;
   const int block_size = 1;
-  int block_num_M = M / block_size;
-  int block_num_N = N / block_size;
-  int block_num_K = K / block_size;
 
   for (i = 0; i < M; ++i) {
     for (j = 0; j < N; ++j) {
@@ -255,6 +256,10 @@ void GemmHostV5(const int M, const int N,
   }
 
   //// Loop through each block of a matrix.
+  //int bi, bj, bk;
+  //int block_num_M = M / block_size;
+  //int block_num_N = N / block_size;
+  //int block_num_K = K / block_size;
   //for (bi = 0; bi < block_num_M; ++bi) { 
   //  for (bk = 0; bk < block_num_K; ++bk) {
   //    for (bj = 0; bj < block_num_N; ++bj) {
@@ -313,6 +318,7 @@ void Gemm::CpuKernelsSetup() {
 
     cpu_kernels_.push_back(kernel);
   }
+#ifdef CUX_X86_SIMD
   // Kernel v2.
   {
     auto func = [&](const int M, const int N,
@@ -369,6 +375,7 @@ void Gemm::CpuKernelsSetup() {
 
     cpu_kernels_.push_back(kernel);
   }
+#endif // CUX_X86_SIMD
   // Kernel v5.
   {
     auto func = [&](const int M, const int N,
@@ -438,13 +445,13 @@ void Gemm::AddPlugin(KernelInterface *kernel_if, OpRunMode mode) {
 void Gemm::ExtractDataTypes(std::vector<int>& type_flags) {
   type_flags.clear();
   type_flags.resize(TYPES_NUM);
-  for (int i = 0; i < type_flags.size(); i++) {
+  for (int i = 0; i < (int)type_flags.size(); i++) {
     type_flags[i] = 0;
   }
-  for (int i = 0; i < cpu_kernels_.size(); i++) {
+  for (int i = 0; i < (int)cpu_kernels_.size(); i++) {
     type_flags[cpu_kernels_[i]->type_flag] = 1;
   }
-  for (int i = 0; i < gpu_kernels_.size(); i++) {
+  for (int i = 0; i < (int)gpu_kernels_.size(); i++) {
     type_flags[gpu_kernels_[i]->type_flag] = 1;
   }
 }
@@ -462,7 +469,7 @@ void Gemm::RunOnHost(const std::vector< Array4D* > &input,
   const int ldb = N;
   const int ldc = N;
 
-  for (int ki = 0; ki < cpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)cpu_kernels_.size(); ki++) {
     GemmCpuKernelIF *kernel = cpu_kernels_[ki];
 
     const void *A, *B;
@@ -489,13 +496,14 @@ void Gemm::RunOnHost(const std::vector< Array4D* > &input,
     );
   }
   // Show.
-  for (int ki = 0; ki < cpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)cpu_kernels_.size(); ki++) {
     PrintRecordedInfo(OpRunMode::ON_HOST, ki, cpu_kernels_[ki]);
   }
 }
 
 //////////////////
 // cuda version.
+#ifndef CUX_CPU_ONLY
 void Gemm::RunOnDevice(const std::vector< Array4D* > &input,
                        const std::vector< Array4D* > &output) {
   CUXLOG_COUT("Gemm -> GPU: ");
@@ -508,7 +516,7 @@ void Gemm::RunOnDevice(const std::vector< Array4D* > &input,
   const int ldb = N;
   const int ldc = N;
 
-  for (int ki = 0; ki < gpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)gpu_kernels_.size(); ki++) {
     GemmGpuKernelIF *kernel = gpu_kernels_[ki];
     Config2D config = kernel->get_config(M, N);
 
@@ -550,9 +558,10 @@ void Gemm::RunOnDevice(const std::vector< Array4D* > &input,
     );
   }
   // Show.
-  for (int ki = 0; ki < gpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)gpu_kernels_.size(); ki++) {
     PrintRecordedInfo(OpRunMode::ON_DEVICE, ki, gpu_kernels_[ki]);
   }
 }
+#endif // CUX_CPU_ONLY
 
 }
\ No newline at end of file
@@ -1,4 +1,8 @@
 #include "operator/nrm2.h"
+#include <cmath>
+#ifdef CUX_X86_SIMD
+#include <immintrin.h>
+#endif
 
 namespace cux {
 
@@ -15,6 +19,7 @@ void Nrm2HostV0(int n, float *x, float *result) {
   *result = std::sqrt(s);
 }
 
+#ifdef CUX_X86_SIMD
 void Nrm2HostV1(int n, float *x, float *result) {
   if (n <= 0) { *result = 0.0; return; };
   if (n == 1) { *result = std::abs(x[0]); return; };
@@ -30,11 +35,14 @@ void Nrm2HostV1(int n, float *x, float *result) {
   for (; i < n; i++) {
     acc += x[i] * x[i];
   }
+  float acc_arr[8];
+  _mm256_storeu_ps(acc_arr, acc8);
   for (j = 0; j < 8; j++) {
-    acc += acc8.m256_f32[j];
+    acc += acc_arr[j];
   }
   *result = std::sqrt(acc);
 }
+#endif // CUX_X86_SIMD
 
 //////////////////////
 void Nrm2::CpuKernelsSetup() {
@@ -52,6 +60,7 @@ void Nrm2::CpuKernelsSetup() {
 
     cpu_kernels_.push_back(kernel);
   }
+#ifdef CUX_X86_SIMD
   // Kernel v1.
   {
     auto func = [&](int n, const void *x, void *result) -> void {
@@ -65,6 +74,7 @@ void Nrm2::CpuKernelsSetup() {
 
     cpu_kernels_.push_back(kernel);
   }
+#endif // CUX_X86_SIMD
 }
 
 //////////////////////
@@ -110,13 +120,13 @@ void Nrm2::AddPlugin(KernelInterface *kernel_if, OpRunMode mode) {
 void Nrm2::ExtractDataTypes(std::vector<int>& type_flags) {
   type_flags.clear();
   type_flags.resize(TYPES_NUM);
-  for (int i = 0; i < type_flags.size(); i++) {
+  for (int i = 0; i < (int)type_flags.size(); i++) {
     type_flags[i] = 0;
   }
-  for (int i = 0; i < cpu_kernels_.size(); i++) {
+  for (int i = 0; i < (int)cpu_kernels_.size(); i++) {
     type_flags[cpu_kernels_[i]->type_flag] = 1;
   }
-  for (int i = 0; i < gpu_kernels_.size(); i++) {
+  for (int i = 0; i < (int)gpu_kernels_.size(); i++) {
     type_flags[gpu_kernels_[i]->type_flag] = 1;
   }
 }
@@ -128,7 +138,7 @@ void Nrm2::RunOnHost(const std::vector< Array4D* > &input,
   IoCheckAndSet(input, output);
 
   const int len = in_->num_element();
-  for (int ki = 0; ki < cpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)cpu_kernels_.size(); ki++) {
     Nrm2CpuKernelIF *kernel = cpu_kernels_[ki];
 
     // Input.
@@ -151,20 +161,21 @@ void Nrm2::RunOnHost(const std::vector< Array4D* > &input,
     );
   }
   // Show.
-  for (int ki = 0; ki < cpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)cpu_kernels_.size(); ki++) {
     PrintRecordedInfo(OpRunMode::ON_HOST, ki, cpu_kernels_[ki]);
   }
 }
 
 //////////////////
 // cuda version.
+#ifndef CUX_CPU_ONLY
 void Nrm2::RunOnDevice(const std::vector< Array4D* > &input,
                        const std::vector< Array4D* > &output) {
   CUXLOG_COUT("Nrm2 -> GPU:");
   IoCheckAndSet(input, output);
 
   const int len = in_->num_element();
-  for (int ki = 0; ki < gpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)gpu_kernels_.size(); ki++) {
     Nrm2GpuKernelIF *kernel = gpu_kernels_[ki];
     Config1D config = kernel->get_config(len);
 
@@ -201,9 +212,10 @@ void Nrm2::RunOnDevice(const std::vector< Array4D* > &input,
     );
   }
   // Show.
-  for (int ki = 0; ki < gpu_kernels_.size(); ki++) {
+  for (int ki = 0; ki < (int)gpu_kernels_.size(); ki++) {
     PrintRecordedInfo(OpRunMode::ON_DEVICE, ki, gpu_kernels_[ki]);
   }
 }
+#endif // CUX_CPU_ONLY
 
 }
\ No newline at end of file
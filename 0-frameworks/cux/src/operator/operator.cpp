@@ -8,6 +8,7 @@ namespace cux {
 
 ///////////////
 // Operator
+#ifndef CUX_CPU_ONLY
 void Operator::QueryPotentialOccupancy(const void *config_kernel, int kernel_id, 
                                        int threads_per_block, int shared_memory_size) {
   if (config_kernel == nullptr 
@@ -21,6 +22,7 @@ void Operator::QueryPotentialOccupancy(const void *config_kernel, int kernel_id,
     config_kernel, threads_per_block, shared_memory_size,
     gpu_kernel_active_blocks_[kernel_id], gpu_kernel_occupancys_[kernel_id]);
 }
+#endif
 
 void Operator::PrintRecordedInfo(const OpRunMode &mode, int kernel_id, const KernelInterface *kernel_info) {
   // TODO: Show config and occupancy.
@@ -2,6 +2,7 @@
 
 namespace cux {
 
+#ifndef CUX_CPU_ONLY
 const char* CublasGetErrorString(cublasStatus_t error) {
   switch (error) {
   case CUBLAS_STATUS_SUCCESS:
@@ -31,4 +32,6 @@ const char* CublasGetErrorString(cublasStatus_t error) {
   }
   return "Unknown cublas status";
 }
+#endif // CUX_CPU_ONLY
+
 } // cux.
\ No newline at end of file
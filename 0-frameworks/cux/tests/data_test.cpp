@@ -101,6 +101,7 @@ void DataBackupTest(int num, int channels, int height, int width, float scale, f
 }
 
 // Push.
+#ifndef CUX_CPU_ONLY
 TEST(DataTest, PushAndBackInt) {
   DataPushTest<int32_t, int32_t>(1, 2, 1, 3, 1.2, -2);
 }
@@ -113,6 +114,7 @@ TEST(DataTest, PushAndBackHalf) {
 TEST(DataTest, PushAndBackChar) {
   DataPushTest<int8_t, int8_t>(1, 3, 1, 3, 123, 32);
 }
+#endif
 
 // Precision convert.
 TEST(DataTest, FpCvtFp32ToHalf) {
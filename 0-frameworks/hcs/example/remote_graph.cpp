@@ -0,0 +1,131 @@
+//#define REMOTE_GRAPH
+#ifdef REMOTE_GRAPH
+
+// Run the part of the graph on another process through mrpc.
+// Usage: remote_graph server
+//        remote_graph client
+//
+// Server: A -- B -- C
+// Client: A -- B -- R(send -- receive) -- E
+// R sends the outputs of B to the server, and E takes the outputs of C.
+
+#include <thread>
+#include <cstring>
+
+#include "hcs/executor.hpp"
+#include "hcs/remote.hpp"
+
+class TestClass : public hcs::TaskAssistor {};
+
+// y = 2x, slowly.
+void WorkDouble(hcs::TaskAssistor *assistor, std::vector<hcs::Blob *> inputs, hcs::Blob *output) {
+  float* in_data = (float *)inputs[0]->GetHostData();
+  output->SyncParams(1, 1, 1, inputs[0]->len(), hcs::ON_HOST, hcs::FLOAT32);
+  float* out_data = (float *)output->GetHostData();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  for (int i = 0; i < inputs[0]->len(); i++) {
+    out_data[i] = in_data[i] * 2;
+  }
+  output->object_id_ = inputs[0]->object_id_;
+}
+
+// y = x + 1.
+void WorkAdd(hcs::TaskAssistor *assistor, std::vector<hcs::Blob *> inputs, hcs::Blob *output) {
+  float* in_data = (float *)inputs[0]->GetHostData();
+  output->SyncParams(1, 1, 1, inputs[0]->len(), hcs::ON_HOST, hcs::FLOAT32);
+  float* out_data = (float *)output->GetHostData();
+
+  for (int i = 0; i < inputs[0]->len(); i++) {
+    out_data[i] = in_data[i] + 1;
+  }
+  output->object_id_ = inputs[0]->object_id_;
+}
+
+void Server(short port) {
+  hcs::Graph graph;
+  hcs::Node *A = graph.emplace()->name("A");
+  hcs::Node *B = graph.emplace(WorkDouble)->name("B");
+  hcs::Node *C = graph.emplace(WorkAdd)->name("C");
+  A->precede(B);
+  B->precede(C);
+  graph.Initialize(10);
+
+  hcs::Executor executor("RemoteServer");
+  TestClass ass;
+  executor.Bind(&graph, hcs::PARALLEL, &ass);
+
+  hcs::RemoteServer server(port);
+  if (!server.Serve("double_add", &graph, &executor))
+    return;
+  printf("Serving on port %d.\n", port);
+  server.Run();
+}
+
+void Client(short port) {
+  int buffer_size = 100;
+
+  hcs::Graph graph;
+  hcs::Node *A = graph.emplace()->name("A");
+  hcs::Node *B = graph.emplace(WorkAdd)->name("B");
+  hcs::RemoteNode remote("127.0.0.1", std::to_string(port), "double_add");
+  std::pair<hcs::Node *, hcs::Node *> R = remote.Emplace(&graph, "R");
+  hcs::Node *E = graph.emplace(WorkAdd)->name("E");
+  A->precede(B);
+  B->precede(R.first);
+  R.second->precede(E);
+  graph.Initialize(buffer_size);
+
+  hcs::Executor executor("RemoteClient");
+  TestClass ass;
+  executor.Bind(&graph, hcs::PARALLEL, &ass);
+
+  hcs::Blob input("in");
+  input.Create(1, 1, 1, 4, hcs::ON_HOST, hcs::FLOAT32);
+  float *data = (float *)input.GetHostData();
+  for (int round = 0; round < 3; round++) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < buffer_size; i++) {
+      for (int j = 0; j < input.len(); j++) {
+        data[j] = i + j;
+      }
+      input.object_id_ = i;
+      A->Enqueue(&input);
+    }
+    executor.Run().wait();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    // ((x + 1) * 2 + 1) + 1 = 2x + 4.
+    int num_wrong = 0;
+    for (int i = 0; i < buffer_size; i++) {
+      hcs::Blob out("out");
+      if (!E->Dequeue(&out) || !out.is_valid()) {
+        num_wrong++;
+        continue;
+      }
+      float *out_data = (float *)out.GetHostData();
+      for (int j = 0; j < out.len(); j++) {
+        if (out_data[j] != 2 * (out.object_id_ + j) + 4)
+          num_wrong++;
+      }
+    }
+    printf("round %d: %d objects in %.1f ms, %d wrong.\n", round, buffer_size, elapsed.count(), num_wrong);
+  }
+  graph.Clean();
+  input.Release();
+}
+
+int main(int argc, char* argv[]) {
+  short port = 9000;
+  if (argc >= 2 && !strcmp(argv[1], "server")) {
+    Server(port);
+  }
+  else if (argc >= 2 && !strcmp(argv[1], "client")) {
+    Client(port);
+  }
+  else {
+    printf("Usage: %s server|client\n", argv[0]);
+  }
+  return 0;
+}
+#endif // REMOTE_GRAPH
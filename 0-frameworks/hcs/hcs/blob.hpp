@@ -15,7 +15,7 @@ class Blob {
 public:
   Blob(std::string name) :is_created_(false),
     data_(nullptr), buffer_(nullptr),
-    need_push_(false),
+    need_push_(false), is_valid_(true),
     len_(0), size_(0),
     object_id_(-1), mode_(-1), type_(-1),
     name_(name), node_name_("noname"){
@@ -25,12 +25,17 @@ public:
 
   //inline void *data() { return data_; }
   inline int mode() const { return mode_; }
+  inline int type() const { return type_; }
   inline int len() const { return len_; }
   inline const std::string &name() const { return name_; }
   inline const std::string &node_name() const { return node_name_; }
   inline std::vector<int> &shape() { return shape_; };
   inline void set_node_name(std::string name) { node_name_ = name; }
   inline bool need_push() const { return need_push_; }
+  // False if the data could not be produced, eg. a remote call failed.
+  // It is passed on to the outputs of the nodes that take the blob.
+  inline bool is_valid() const { return is_valid_; }
+  inline void set_valid(bool is_valid) { is_valid_ = is_valid; }
 
   bool Create(int num, int channel, int height, int width, int mode, int type);
   void Release();
@@ -62,6 +67,7 @@ private:
   void *buffer_;
   // If true, push buffer to data.
   bool need_push_;
+  bool is_valid_;
 
   // The number of elements.
   int len_;
@@ -217,6 +223,7 @@ bool Blob::CloneTo(Blob *to) {
 
   // Pass object id.
   to->object_id_ = object_id_;
+  to->is_valid_ = is_valid_;
   return true;
 }
 
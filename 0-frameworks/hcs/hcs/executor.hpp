@@ -211,7 +211,8 @@ bool Executor::Process(Node *node, Timer *timer) {
     }
   }
 
-  // Run.
+  // Run. The task may mark its output invalid.
+  output->set_valid(true);
   TIME_DIFF_RECORD((*timer), node->Run(task_assistor_, inputs, output););
 
   // Push if needed.
@@ -219,8 +220,12 @@ bool Executor::Process(Node *node, Timer *timer) {
     output->PushBuffer(task_assistor_->stream());
   }
 
-  // Pass object_id_.
+  // Pass object_id_, and the invalid mark of any input.
   output->object_id_ = inputs[0]->object_id_;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    if (!inputs[i]->is_valid())
+      output->set_valid(false);
+  }
 
   { // Recycle inputs & Push output.
     std::unique_lock<std::mutex> locker(mutex_);
@@ -0,0 +1,274 @@
+/*!
+* \brief Remote nodes, a graph spans processes through mrpc.
+*/
+
+#ifndef HCS_REMOTE_H_
+#define HCS_REMOTE_H_
+
+#include <climits>
+#include <cstdint>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client.h"
+#include "server.h"
+
+#include "executor.hpp"
+#include "graph.hpp"
+
+namespace hcs {
+
+// A Blob on the wire. The data is always on the host.
+struct WireBlob {
+  int object_id;
+  int type;
+  std::vector<int> shape;
+  std::vector<char> data;
+  HANDYPACK(object_id, type, shape, data)
+};
+
+// Copy a blob into its wire form, from the device if the blob is there.
+inline void BlobToWire(Blob *blob, WireBlob *wire) {
+  wire->object_id = blob->object_id_;
+  wire->type = blob->type();
+  wire->shape = blob->shape();
+  size_t size = 0;
+  TYPE_SWITCH(blob->type(), T, size = sizeof(T) * blob->len(););
+  wire->data.resize(size);
+  if (blob->mode() == ON_HOST) {
+    memcpy(wire->data.data(), blob->GetHostData(), size);
+  }
+  else {
+    CUDA_CHECK(cudaMemcpy(wire->data.data(), blob->GetDeviceData(), size, cudaMemcpyDeviceToHost));
+  }
+}
+
+// Recreate a blob from its wire form in the given memory mode.
+// Returns false if the wire form is inconsistent.
+inline bool WireToBlob(WireBlob &wire, Blob *blob, int mode) {
+  if (wire.shape.size() != 4 || wire.type < 0 || wire.type >= TYPES_NUM)
+    return false;
+  // The wire form comes from the network, so check the shape and the size
+  // of the data before anything is allocated. Blob counts its elements in int.
+  uint64_t count = 1;
+  for (int dim : wire.shape) {
+    if (dim <= 0 || count > INT_MAX / (uint64_t)dim)
+      return false;
+    count *= dim;
+  }
+  uint64_t size = 0;
+  TYPE_SWITCH(wire.type, T, size = sizeof(T) * count;);
+  if (size != wire.data.size())
+    return false;
+  if (!blob->SyncParams(wire.shape[0], wire.shape[1], wire.shape[2], wire.shape[3], mode, wire.type))
+    return false;
+
+  if (mode == ON_HOST) {
+    memcpy(blob->GetHostData(), wire.data.data(), size);
+  }
+  else {
+    CUDA_CHECK(cudaMemcpy(blob->GetDeviceData(), wire.data.data(), size, cudaMemcpyHostToDevice));
+  }
+  blob->object_id_ = wire.object_id;
+  return true;
+}
+
+// Class: RemoteNode
+// Runs a part of the graph in another process, which serves it with
+// RemoteServer. It is a pair of nodes: the send node packs its input
+// blobs into a call, and passes a token on to the receive node, which
+// waits for the response and unpacks the output blob. In the PARALLEL
+// mode the send node goes on with the next objects meanwhile, so up to
+// buffer_queue_size objects are in flight on the connection, and the
+// transfers overlap the computation of the remote graph. If a call fails,
+// the output blob is marked invalid, see Blob::is_valid(). The remote
+// graph should have a single output node.
+// Usage:
+//   hcs::RemoteNode remote("127.0.0.1", "9000", "subgraph");
+//   auto nodes = remote.Emplace(&graph, "R");
+//   B->precede(nodes.first);
+//   nodes.second->precede(E);
+class RemoteNode {
+  typedef mrpc::Response<std::vector<WireBlob>> Response;
+
+public:
+  // mode: where the output blobs are placed, ON_HOST or ON_DEVICE.
+  RemoteNode(std::string host, std::string service, const std::string &method, int mode = ON_HOST)
+    : method_id_(mrpc::MethodId(method)), mode_(mode), client_(io_context_),
+      work_(asio::make_work_guard(io_context_)) {
+    client_.Connect(host, service);
+    io_thread_ = std::thread([this]() { io_context_.run(); });
+  }
+  ~RemoteNode() {
+    work_.reset();
+    io_context_.stop();
+    io_thread_.join();
+  }
+
+  // Add the send node and the receive node to the graph, the former
+  // precedes the latter. Returns the pair of them.
+  std::pair<Node *, Node *> Emplace(Graph *graph, const std::string &name) {
+    Node *send = graph->emplace([this](TaskAssistor *, std::vector<Blob *> inputs, Blob *output) {
+      Send(inputs, output);
+    })->name(name + "-send");
+    Node *receive = graph->emplace([this](TaskAssistor *, std::vector<Blob *> inputs, Blob *output) {
+      Receive(inputs, output);
+    })->name(name + "-receive");
+    send->precede(receive);
+    return std::make_pair(send, receive);
+  }
+
+private:
+  // The responses are taken in the order of the calls, the token only
+  // carries the object to the receive node. An invalid token means that
+  // nothing has been sent for the object.
+  void Send(std::vector<Blob *> &inputs, Blob *output) {
+    output->SyncParams(1, 1, 1, 1, ON_HOST, INT32);
+    if (inputs.empty()) {
+      LOG(WARNING) << "RemoteNode::Send -> No input blob.";
+      output->set_valid(false);
+      return;
+    }
+    *(int32_t *)output->GetHostData() = inputs[0]->object_id_;
+
+    std::vector<WireBlob> wires(inputs.size());
+    for (size_t i = 0; i < inputs.size(); i++) {
+      if (!inputs[i]->is_valid()) {
+        LOG(WARNING) << "RemoteNode::Send -> Invalid input blob.";
+        output->set_valid(false);
+        return;
+      }
+      BlobToWire(inputs[i], &wires[i]);
+    }
+    in_flight_.push(client_.AsyncCall<std::vector<WireBlob>>(
+      method_id_, asio::use_future, wires).share());
+  }
+
+  void Receive(std::vector<Blob *> &inputs, Blob *output) {
+    if (inputs.empty() || !inputs[0]->is_valid()) {
+      Fail(output);
+      return;
+    }
+    std::shared_future<Response> future;
+    in_flight_.wait_and_pop(&future);
+    const Response &ret = future.get();
+    if (ret.status != mrpc::STATUS_OK) {
+      LOG(WARNING) << "RemoteNode::Receive -> The remote call failed: " << ret.error_str;
+      Fail(output);
+      return;
+    }
+    if (ret.value.size() != 1) {
+      LOG(WARNING) << "RemoteNode::Receive -> Expect 1 output blob, but got " << ret.value.size();
+      Fail(output);
+      return;
+    }
+    WireBlob wire = ret.value[0];
+    if (!WireToBlob(wire, output, mode_)) {
+      LOG(WARNING) << "RemoteNode::Receive -> Invalid output blob.";
+      Fail(output);
+    }
+  }
+
+  // Mark the output invalid. It still gets a shape if it has none, so that
+  // it can be passed on to the next nodes.
+  void Fail(Blob *output) {
+    if (output->shape().empty())
+      output->SyncParams(1, 1, 1, 1, mode_, INT32);
+    output->set_valid(false);
+  }
+
+private:
+  uint32_t method_id_;
+  int mode_;
+
+  asio::io_context io_context_;
+  mrpc::Client client_;
+  asio::executor_work_guard<asio::io_context::executor_type> work_;
+  // Runs the io_context of the client.
+  std::thread io_thread_;
+
+  // The calls sent and not received yet, in order.
+  BlockingQueue<std::shared_future<Response>> in_flight_;
+};
+
+// Class: RemoteServer
+// Serves graphs to the RemoteNodes of other processes.
+class RemoteServer {
+public:
+  RemoteServer(short port) : server_(port, 1) {
+    // The graph runs on a worker thread, so that the session keeps
+    // reading the next calls and writing the responses meanwhile.
+    server_.SetWorkerPool(1, 1024);
+  }
+
+  // Serve the graph as the method. The graph should have been initialized
+  // and bound to the executor, with a single output node. The input blobs
+  // of a call are enqueued into the input nodes in order, and the graph is
+  // run for them. The response has the blob of the output node, or is
+  // empty if the call failed. Calls are run one by one.
+  // Returns false if the graph can not be served.
+  bool Serve(const std::string &method, Graph *graph, Executor *executor) {
+    if (graph->GetOutputNodes().size() != 1) {
+      LOG(ERROR) << "RemoteServer::Serve -> Expect 1 output node, but got " 
+        << graph->GetOutputNodes().size();
+      return false;
+    }
+    server_.Bind<std::vector<WireBlob>, std::vector<WireBlob>>(method,
+      [this, graph, executor](std::vector<WireBlob> &inputs) {
+      std::unique_lock<std::mutex> locker(mutex_);
+      std::vector<WireBlob> outputs;
+      std::vector<Node *> input_nodes = graph->GetInputNodes();
+      if (inputs.size() != input_nodes.size()) {
+        LOG(WARNING) << "RemoteServer -> Expect " << input_nodes.size()
+          << " input blobs, but got " << inputs.size();
+        return outputs;
+      }
+      for (size_t i = 0; i < inputs.size(); i++) {
+        Blob in("remote-in");
+        if (!WireToBlob(inputs[i], &in, ON_HOST)) {
+          LOG(WARNING) << "RemoteServer -> Invalid input blob.";
+          return outputs;
+        }
+        if (!input_nodes[i]->Enqueue(&in)) {
+          LOG(WARNING) << "RemoteServer -> Failed to enqueue the input blob.";
+          return outputs;
+        }
+      }
+      executor->Run().wait();
+
+      std::vector<Node *> output_nodes = graph->GetOutputNodes();
+      outputs.resize(output_nodes.size());
+      bool is_ok = true;
+      // Take from all of them even after a failure, to keep them in step.
+      for (size_t i = 0; i < output_nodes.size(); i++) {
+        Blob out("remote-out");
+        if (!output_nodes[i]->Dequeue(&out) || !out.is_valid()) {
+          is_ok = false;
+          continue;
+        }
+        BlobToWire(&out, &outputs[i]);
+      }
+      if (!is_ok) {
+        LOG(WARNING) << "RemoteServer -> Failed to take the output blobs.";
+        outputs.clear();
+      }
+      return outputs;
+    }, mrpc::EXEC_POOL);
+    return true;
+  }
+
+  // Blocks until Stop() is called.
+  void Run() { server_.Run(); }
+  void Stop() { server_.Stop(); }
+
+private:
+  mrpc::Server server_;
+  std::mutex mutex_;
+};
+
+}  // namespace hcs.
+
+#endif // HCS_REMOTE_H_
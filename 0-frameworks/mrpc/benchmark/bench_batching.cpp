@@ -0,0 +1,83 @@
+/////////////////////////////////////////
+// Bursts of tiny asynchronous calls with and without client batching.
+// The calls are issued by the main thread while another thread runs the
+// io_context of the client, as an application would. For each setting
+// it prints the calls per second and the read and write operations on
+// the client's transport per call, each of which is at least one syscall.
+// The server saves as many writes, and one dispatch per batch.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "client.h"
+#include "server.h"
+
+struct Setting {
+  const char *name;
+  bool is_batching;
+  size_t max_calls;
+  int window_us;
+};
+
+int main(int argc, char* argv[]) {
+  short port = 8084;
+  const int kBurst = 1000;
+  const int kNumBursts = 200;
+
+  mrpc::Server server(port, 1);
+  server.Bind<int, int, int>("multiply", [](int &a, int &b) { return a * b; });
+  std::thread server_thread([&server]() { server.Run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  const Setting settings[] = {
+    { "off", false, 0, 0 },
+    { "64/0us", true, 64, 0 },
+    { "64/50us", true, 64, 50 },
+    { "256/50us", true, 256, 50 },
+  };
+  const uint32_t method_id = mrpc::MethodId("multiply");
+  std::string host = "127.0.0.1", service = std::to_string(port);
+
+  printf("%10s %12s %12s %12s\n", "batching", "calls/s", "reads/call", "writes/call");
+  for (const Setting &setting : settings) {
+    asio::io_context io_context;
+    auto work = asio::make_work_guard(io_context);
+    mrpc::Client client(io_context);
+    client.Connect(host, service);
+    mrpc::BatchOptions options;
+    options.max_calls = setting.max_calls;
+    options.window = std::chrono::microseconds(setting.window_us);
+    client.set_batching(setting.is_batching, options);
+    std::thread io_thread([&io_context]() { io_context.run(); });
+
+    std::atomic<int> num_done(0), num_failed(0);
+    auto start = std::chrono::steady_clock::now();
+    for (int n = 0; n < kNumBursts; n++) {
+      for (int i = 0; i < kBurst; i++) {
+        int A = i, B = 3;
+        client.AsyncCall<int>(method_id, [&num_done, &num_failed, i](mrpc::Response<int> ret) {
+          if (ret.status != mrpc::STATUS_OK || ret.value != i * 3)
+            num_failed++;
+          num_done++;
+        }, A, B);
+      }
+      while (num_done < (n + 1) * kBurst)
+        std::this_thread::yield();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    work.reset();
+    io_thread.join();
+    double num_calls = (double)kBurst * kNumBursts;
+    printf("%10s %12.0f %12.3f %12.3f", setting.name, num_calls / elapsed.count(),
+      client.num_reads() / num_calls, client.num_writes() / num_calls);
+    if (num_failed)
+      printf("  (%d failed)", num_failed.load());
+    printf("\n");
+  }
+
+  server.Stop();
+  server_thread.join();
+  return 0;
+}
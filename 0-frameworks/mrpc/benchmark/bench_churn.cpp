@@ -0,0 +1,99 @@
+/////////////////////////////////////////
+// Connection churn: short-lived clients that connect, make one call and
+// disconnect, with and without reusing the sessions on the server.
+// It prints the connections per second, and the allocations of the
+// server thread per connection, counted by replacing operator new.
+// The storage of Buffer is allocated by malloc and is not counted, a
+// new session allocates 64KB for reading and the buffers of its messages.
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+#include "client.h"
+#include "server.h"
+
+static std::atomic<uint64_t> g_num_allocs(0);
+static std::atomic<uint64_t> g_alloc_bytes(0);
+// Only the allocations of the server thread are counted.
+static thread_local bool t_is_counted = false;
+
+// Not inlined, or gcc takes the frees for mismatched with the news.
+#ifdef __GNUC__
+#define BENCH_NOINLINE __attribute__((noinline))
+#else
+#define BENCH_NOINLINE
+#endif
+
+BENCH_NOINLINE void *operator new(size_t size) {
+  if (t_is_counted) {
+    g_num_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+  }
+  void *p = malloc(size == 0 ? 1 : size);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return p;
+}
+BENCH_NOINLINE void operator delete(void *p) noexcept { free(p); }
+BENCH_NOINLINE void operator delete(void *p, size_t) noexcept { free(p); }
+
+int main(int argc, char* argv[]) {
+  short port = 8087;
+  const int kNumConnections = 5000;
+
+  mrpc::Server server(port, 1);
+  server.Bind<int, int>("echo", [](int &x) { return x; });
+  std::thread server_thread([&server]() {
+    t_is_counted = true;
+    server.Run();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  std::string host = "127.0.0.1", service = std::to_string(port);
+  const size_t max_idle[] = { 0, 64 };
+
+  printf("%10s %12s %12s %14s %12s\n", "pool", "conns/s", "us/conn", "allocs/conn", "bytes/conn");
+  for (size_t idle : max_idle) {
+    server.SetSessionPool(idle);
+    int num_failed = 0;
+    // Warm up, so that the pool is filled.
+    for (int i = 0; i < 100; i++) {
+      asio::io_context io_context;
+      mrpc::Client client(io_context);
+      client.Connect(host, service);
+      client.Call<int>("echo", i);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    uint64_t allocs = g_num_allocs, bytes = g_alloc_bytes;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kNumConnections; i++) {
+      asio::io_context io_context;
+      mrpc::Client client(io_context);
+      client.Connect(host, service);
+      if (client.Call<int>("echo", i).value != i)
+        num_failed++;
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    // Let the server release the last sessions.
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    allocs = g_num_allocs - allocs;
+    bytes = g_alloc_bytes - bytes;
+
+    printf("%10zu %12.0f %12.2f %14.1f %12.0f", idle, kNumConnections / elapsed.count(),
+      elapsed.count() * 1e6 / kNumConnections, (double)allocs / kNumConnections,
+      (double)bytes / kNumConnections);
+    if (num_failed)
+      printf("  (%d failed)", num_failed);
+    printf("\n");
+  }
+  printf("sessions created: %zu, reused: %zu\n",
+    server.num_sessions_created(), server.num_sessions_reused());
+
+  server.Stop();
+  server_thread.join();
+  return 0;
+}
@@ -0,0 +1,110 @@
+/////////////////////////////////////////
+// Large array responses with and without per-frame compression.
+// For each payload and codec it prints the time per call on loopback,
+// the body bytes on the wire per call, the compression ratio, and the
+// cycles spent on compressing on the server and decompressing on the
+// client. Loopback is faster than any codec, so compression only costs
+// time here. "break-even" is the link speed below which it pays off:
+// the bytes saved per second of compressing and decompressing them.
+
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "client.h"
+#include "server.h"
+
+struct Payload {
+  const char *name;
+  std::vector<float> data;
+};
+
+struct Setting {
+  const char *name;
+  bool is_enabled;
+  mrpc::CompressionCodec codec;
+};
+
+int main(int argc, char* argv[]) {
+  short port = 8088;
+  const int kLength = 256 * 1024;
+  const int kNumCalls = 200;
+
+  std::vector<Payload> payloads(3);
+  // A periodic signal quantized to 1/100, eg. readings of a sensor.
+  payloads[0].name = "signal";
+  // Small counts, most of them 0, eg. a sparse histogram.
+  payloads[1].name = "sparse";
+  // Incompressible, it is sent as it is after a failed attempt.
+  payloads[2].name = "random";
+  std::mt19937 rng(7);
+  for (int i = 0; i < kLength; i++) {
+    payloads[0].data.push_back(std::round(std::sin(i * 0.01f) * 100) / 100);
+    payloads[1].data.push_back(rng() % 16 == 0 ? (float)(rng() % 8) : 0.0f);
+    payloads[2].data.push_back((float)rng() / rng.max());
+  }
+
+  std::vector<Setting> settings = {
+    { "off", false, mrpc::CODEC_LZ },
+    { "lz", true, mrpc::CODEC_LZ },
+  };
+  if (mrpc::Compression::IsSupported(mrpc::CODEC_ZLIB))
+    settings.push_back({ "zlib", true, mrpc::CODEC_ZLIB });
+
+  printf("%8s %6s %10s %12s %8s %14s %14s %12s\n", "payload", "codec", "us/call",
+    "bytes/call", "ratio", "compress us", "decompress us", "break-even");
+  for (const Setting &setting : settings) {
+    mrpc::Server server(port, 1);
+    mrpc::CompressionOptions options;
+    options.codec = setting.codec;
+    server.SetCompression(options);
+    server.Bind<std::vector<float>, int>("get", [&payloads](int &index) {
+      return payloads[index].data;
+    });
+    std::thread server_thread([&server]() { server.Run(); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    std::string host = "127.0.0.1", service = std::to_string(port);
+    for (int index = 0; index < (int)payloads.size(); index++) {
+      asio::io_context io_context;
+      mrpc::Client client(io_context);
+      client.Connect(host, service);
+      client.set_compression(setting.is_enabled, options);
+      mrpc::CompressionStats server_before = server.compression_stats();
+
+      int num_failed = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < kNumCalls; i++) {
+        mrpc::Response<std::vector<float>> ret = client.Call<std::vector<float>>("get", index);
+        if (ret.status != mrpc::STATUS_OK || ret.value != payloads[index].data)
+          num_failed++;
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      mrpc::CompressionStats server_stats = server.compression_stats();
+      mrpc::CompressionStats client_stats = client.compression_stats();
+      uint64_t raw = sizeof(float) * kLength + sizeof(uint32_t);
+      uint64_t compressed = server_stats.compressed_bytes - server_before.compressed_bytes;
+      uint64_t frames = server_stats.frames_compressed - server_before.frames_compressed;
+      uint64_t wire = (compressed + (kNumCalls - frames) * raw) / kNumCalls;
+      double compress_us = (server_stats.compress_ns - server_before.compress_ns) / 1e3 / kNumCalls;
+      double decompress_us = client_stats.decompress_ns / 1e3 / kNumCalls;
+      double ratio = (double)wire / raw;
+
+      printf("%8s %6s %10.1f %12llu %8.3f %14.1f %14.1f", payloads[index].name, setting.name,
+        elapsed.count() * 1e6 / kNumCalls, (unsigned long long)wire, ratio, compress_us, decompress_us);
+      if (compress_us + decompress_us > 0 && wire < raw)
+        printf(" %8.0f MB/s", (raw - wire) / (compress_us + decompress_us));
+      else
+        printf(" %12s", "-");
+      if (num_failed)
+        printf("  (%d failed)", num_failed);
+      printf("\n");
+    }
+    server.Stop();
+    server_thread.join();
+  }
+  return 0;
+}
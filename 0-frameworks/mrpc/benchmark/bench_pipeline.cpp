@@ -0,0 +1,69 @@
+/////////////////////////////////////////
+// Throughput of one connection versus the number of requests in flight.
+// The server runs on a thread of this process, and the client keeps
+// <depth> requests pipelined on a single socket.
+
+#include <chrono>
+#include <deque>
+#include <thread>
+
+#include "client.h"
+#include "server.h"
+
+int main(int argc, char* argv[]) {
+  short port = 8081;
+  const int kNumCalls = 100000;
+
+  asio::io_context server_context;
+  mrpc::Server server(server_context, port);
+  server.Bind<int, int, int>("multiply",
+    [](int a, int b) -> int { return a * b; });
+  std::thread server_thread([&server_context]() { server_context.run(); });
+
+  std::string host = "127.0.0.1";
+  std::string service = std::to_string(port);
+  asio::io_context io_context;
+  mrpc::Client client(io_context);
+
+  try {
+    client.Connect(host, service);
+
+    const uint32_t method_id = mrpc::MethodId("multiply");
+    printf("%8s %12s %12s\n", "depth", "calls/s", "us/call");
+    for (int depth = 1; depth <= 256; depth *= 2) {
+      int A = 15, B = 12;
+      std::deque<uint64_t> in_flight;
+      int num_sent = 0, num_failed = 0;
+
+      auto start = std::chrono::steady_clock::now();
+      while (num_sent < depth) {
+        in_flight.push_back(client.Send(method_id, A, B));
+        num_sent++;
+      }
+      while (!in_flight.empty()) {
+        auto ret = client.Receive<int>(in_flight.front());
+        in_flight.pop_front();
+        if (ret.status != mrpc::STATUS_OK || ret.value != A * B)
+          num_failed++;
+        if (num_sent < kNumCalls) {
+          in_flight.push_back(client.Send(method_id, A, B));
+          num_sent++;
+        }
+      }
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      printf("%8d %12.0f %12.2f", depth, kNumCalls / elapsed.count(), 
+        elapsed.count() * 1e6 / kNumCalls);
+      if (num_failed)
+        printf("  (%d failed)", num_failed);
+      printf("\n");
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "Exception: " << e.what() << "\n";
+  }
+
+  server_context.stop();
+  server_thread.join();
+  return 0;
+}
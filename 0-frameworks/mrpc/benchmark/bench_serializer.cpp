@@ -0,0 +1,114 @@
+/////////////////////////////////////////
+// Speed of Serializer for the common argument types.
+// Each case dumps the value into a reused buffer and loads it back.
+// The "pack" cases pack the value into a new message each time, where
+// the size pass decides how many times the buffer is allocated.
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "message.h"
+
+// A typical integer-heavy message: small ids and counts.
+struct Lookup {
+  uint32_t user_id;
+  int32_t count;
+  int64_t offset;
+  std::vector<uint32_t> item_ids;
+  HANDYPACK(user_id, count, offset, item_ids)
+};
+
+// A fixed-layout struct, its size is known at compile time.
+struct Point {
+  float x, y, z;
+  int32_t id;
+  HANDYPACK(x, y, z, id)
+};
+static_assert(mrpc::Serializer::FixedSize<Point>::value == 16, "Point has a fixed layout.");
+static_assert(mrpc::Serializer::FixedSize<Lookup>::value == 0, "Lookup has a vector.");
+
+template <typename T>
+void Bench(const char *name, const T &value, int num_iters, bool is_compact = false) {
+  mrpc::Buffer buffer;
+  buffer.set_compact(is_compact);
+  T loaded;
+
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_iters; i++) {
+    buffer.Clear();
+    mrpc::Serializer::Dump(buffer, value);
+    mrpc::Serializer::Load(buffer, loaded);
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  double bytes = (double)buffer.size() * num_iters;
+  printf("%-24s %10zu bytes %10.2f us/iter %10.2f GB/s\n", name, buffer.size(),
+    elapsed.count() * 1e6 / num_iters, bytes / elapsed.count() / 1e9);
+}
+
+template <typename T>
+void BenchPack(const char *name, T &value, int num_iters) {
+  size_t length = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < num_iters; i++) {
+    mrpc::RpcMessage message;
+    message.Pack(value);
+    length = message.body_length();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  printf("%-24s %10zu bytes %10.2f us/iter %10.2f GB/s\n", name, length,
+    elapsed.count() * 1e6 / num_iters, (double)length * num_iters / elapsed.count() / 1e9);
+}
+
+int main(int argc, char* argv[]) {
+  std::vector<float> tensor(4 << 20);
+  for (size_t i = 0; i < tensor.size(); i++)
+    tensor[i] = (float)i;
+  Bench("vector<float> 16MB", tensor, 20);
+  // Loaded in place without allocating and copying.
+  Bench("ArrayView<float> 16MB", mrpc::ArrayView<float>(tensor), 20);
+
+  std::vector<float> small_tensor(256, 1.0f);
+  Bench("vector<float> 1KB", small_tensor, 100000);
+
+  std::string text(1 << 20, 'x');
+  Bench("string 1MB", text, 200);
+
+  std::vector<std::vector<float>> tensors(64, std::vector<float>(16 << 10, 2.0f));
+  Bench("vector<vector<float>> 4MB", tensors, 50);
+
+  std::vector<std::string> words(10000, "word");
+  Bench("vector<string> 10000", words, 1000);
+
+  // Fixed-width versus compact (varint) encoding.
+  Lookup lookup;
+  lookup.user_id = 1024;
+  lookup.count = 20;
+  lookup.offset = -3;
+  for (uint32_t i = 0; i < 20; i++)
+    lookup.item_ids.push_back(i * 37);
+  Bench("Lookup fixed", lookup, 1000000, false);
+  Bench("Lookup compact", lookup, 1000000, true);
+
+  std::vector<int64_t> counts(4096);
+  for (size_t i = 0; i < counts.size(); i++)
+    counts[i] = (int64_t)(i % 300) - 150;
+  Bench("vector<int64_t> fixed", counts, 10000, false);
+  Bench("vector<int64_t> compact", counts, 10000, true);
+
+  std::vector<Point> points(10000);
+  for (size_t i = 0; i < points.size(); i++) {
+    points[i].x = (float)i;
+    points[i].y = 1.0f;
+    points[i].z = 2.0f;
+    points[i].id = (int32_t)i;
+  }
+  Bench("vector<Point> 10000", points, 2000);
+  BenchPack("pack vector<Point>", points, 2000);
+  BenchPack("pack Lookup", lookup, 1000000);
+  std::vector<Lookup> lookups(1000, lookup);
+  BenchPack("pack vector<Lookup>", lookups, 2000);
+
+  return 0;
+}
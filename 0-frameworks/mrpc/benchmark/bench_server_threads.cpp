@@ -0,0 +1,99 @@
+/////////////////////////////////////////
+// Server throughput versus the number of server threads.
+// The server runs in the multi-thread mode in this process, and it is
+// loaded by asynchronous clients on their own threads, each of them
+// keeps several calls in flight.
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "client.h"
+#include "server.h"
+
+// Keep <depth> calls in flight on the client until the deadline.
+class Loader {
+public:
+  Loader(asio::io_context &io_context, std::string &host, std::string &service,
+         std::atomic<int64_t> *num_calls)
+    : client_(io_context), num_calls_(num_calls), A(15), B(12) {
+    client_.Connect(host, service);
+  }
+
+  void Start(int depth, std::chrono::steady_clock::time_point deadline) {
+    deadline_ = deadline;
+    for (int i = 0; i < depth; i++)
+      Issue();
+  }
+
+private:
+  void Issue() {
+    client_.AsyncCall<int>(method_id_, [this](mrpc::Response<int> ret) {
+      if (ret.status == mrpc::STATUS_OK)
+        num_calls_->fetch_add(1, std::memory_order_relaxed);
+      if (std::chrono::steady_clock::now() < deadline_)
+        Issue();
+    }, A, B);
+  }
+
+private:
+  mrpc::Client client_;
+  std::atomic<int64_t> *num_calls_;
+  std::chrono::steady_clock::time_point deadline_;
+  const uint32_t method_id_ = mrpc::MethodId("multiply");
+  int A, B;
+};
+
+int main(int argc, char* argv[]) {
+  short port = 8082;
+  const int kNumClientThreads = 4;
+  const int kConnectionsPerThread = 4;
+  const int kDepth = 16;
+  const double kSeconds = 2.0;
+
+  int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  printf("%8s %12s\n", "threads", "calls/s");
+  for (int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+    mrpc::Server server(port, num_threads);
+    server.Bind<int, int, int>("multiply",
+      [](int a, int b) -> int { return a * b; });
+    std::thread server_thread([&server]() { server.Run(); });
+
+    std::string host = "127.0.0.1";
+    std::string service = std::to_string(port);
+    std::atomic<int64_t> num_calls(0);
+    try {
+      std::vector<std::unique_ptr<asio::io_context>> contexts;
+      std::vector<std::unique_ptr<Loader>> loaders;
+      for (int i = 0; i < kNumClientThreads; i++) {
+        contexts.emplace_back(new asio::io_context(1));
+        for (int j = 0; j < kConnectionsPerThread; j++)
+          loaders.emplace_back(new Loader(*contexts.back(), host, service, &num_calls));
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(kSeconds));
+      for (auto &loader : loaders)
+        loader->Start(kDepth, deadline);
+
+      std::vector<std::thread> client_threads;
+      for (auto &context : contexts) {
+        asio::io_context *ctx = context.get();
+        client_threads.emplace_back([ctx]() { ctx->run(); });
+      }
+      for (auto &thread : client_threads)
+        thread.join();
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+      printf("%8d %12.0f\n", num_threads, num_calls.load() / elapsed.count());
+    }
+    catch (std::exception& e) {
+      std::cerr << "Exception: " << e.what() << "\n";
+    }
+
+    server.Stop();
+    server_thread.join();
+  }
+  return 0;
+}
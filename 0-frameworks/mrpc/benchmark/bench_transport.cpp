@@ -0,0 +1,81 @@
+/////////////////////////////////////////
+// Round-trip latency of a small call for each transport, measured with
+// synchronous calls from one client to a server in this process.
+// The shared-memory ring only spins before sleeping on multi-core
+// machines, run it with at least two cores to see its best case.
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "client.h"
+#include "server.h"
+
+// Returns the median and the 99th percentile in microseconds.
+static void Measure(mrpc::Client &client, int num_calls, double *p50, double *p99) {
+  const uint32_t method_id = mrpc::MethodId("multiply");
+  int A = 15, B = 12;
+  for (int i = 0; i < num_calls / 10; i++)
+    client.Call<int>(method_id, A, B);
+
+  std::vector<double> latencies(num_calls);
+  for (int i = 0; i < num_calls; i++) {
+    auto start = std::chrono::steady_clock::now();
+    client.Call<int>(method_id, A, B);
+    latencies[i] = std::chrono::duration<double, std::micro>(
+      std::chrono::steady_clock::now() - start).count();
+  }
+  std::sort(latencies.begin(), latencies.end());
+  *p50 = latencies[num_calls / 2];
+  *p99 = latencies[num_calls * 99 / 100];
+}
+
+int main(int argc, char* argv[]) {
+  short port = 8083;
+  std::string local_path = "/tmp/mrpc_bench.sock";
+  std::string shm_path = "/tmp/mrpc_bench.shm";
+  const int kNumCalls = 100000;
+
+  mrpc::Server server(port, 1);
+  server.Bind<int, int, int>("multiply", [](int &a, int &b) { return a * b; });
+#ifndef _WIN32
+  server.ListenLocal(local_path);
+#endif
+#ifdef __linux__
+  server.ListenShm(shm_path);
+#endif
+  std::thread server_thread([&server]() { server.Run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  asio::io_context io_context;
+  double p50, p99;
+  printf("%8s %10s %10s\n", "transport", "p50(us)", "p99(us)");
+  {
+    std::string host = "127.0.0.1", service = std::to_string(port);
+    mrpc::Client client(io_context);
+    client.Connect(host, service);
+    Measure(client, kNumCalls, &p50, &p99);
+    printf("%8s %10.2f %10.2f\n", "tcp", p50, p99);
+  }
+#ifndef _WIN32
+  {
+    mrpc::Client client(io_context);
+    client.ConnectLocal(local_path);
+    Measure(client, kNumCalls, &p50, &p99);
+    printf("%8s %10.2f %10.2f\n", "unix", p50, p99);
+  }
+#endif
+#ifdef __linux__
+  {
+    mrpc::Client client(io_context);
+    client.ConnectShm(shm_path);
+    Measure(client, kNumCalls, &p50, &p99);
+    printf("%8s %10.2f %10.2f\n", "shm", p50, p99);
+  }
+#endif
+
+  server.Stop();
+  server_thread.join();
+  return 0;
+}
@@ -0,0 +1,108 @@
+#ifndef MRPC_HDR_HISTOGRAM_H_
+#define MRPC_HDR_HISTOGRAM_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace mrpc {
+
+// High dynamic range histogram of non-negative integers (eg. nanoseconds),
+// with 3 significant digits over the whole range of uint64_t: values below
+// 2048 are counted exactly, and above that each power of two is split into
+// 1024 buckets. Recording is one index computation and an increment, and
+// histograms recorded on separate threads are combined by Add().
+class HdrHistogram {
+  const static int SUB_BUCKET_BITS = 11;
+  const static uint64_t SUB_BUCKET_COUNT = 1ull << SUB_BUCKET_BITS;
+  const static uint64_t SUB_BUCKET_HALF = SUB_BUCKET_COUNT / 2;
+  const static int NUM_BUCKETS = SUB_BUCKET_COUNT + (64 - SUB_BUCKET_BITS) * SUB_BUCKET_HALF;
+
+public:
+  HdrHistogram() : counts_(NUM_BUCKETS, 0), total_(0), sum_(0), min_(UINT64_MAX), max_(0) {}
+
+  inline void Record(uint64_t value) {
+    counts_[Index(value)]++;
+    total_++;
+    sum_ += value;
+    min_ = std::min(min_, value);
+    max_ = std::max(max_, value);
+  }
+
+  void Add(const HdrHistogram &other) {
+    for (int i = 0; i < NUM_BUCKETS; i++)
+      counts_[i] += other.counts_[i];
+    total_ += other.total_;
+    sum_ += other.sum_;
+    min_ = std::min(min_, other.min_);
+    max_ = std::max(max_, other.max_);
+  }
+
+  void Reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    total_ = sum_ = max_ = 0;
+    min_ = UINT64_MAX;
+  }
+
+  inline uint64_t count() const { return total_; }
+  inline uint64_t min() const { return total_ ? min_ : 0; }
+  inline uint64_t max() const { return max_; }
+  inline double mean() const { return total_ ? (double)sum_ / total_ : 0.0; }
+
+  // The value at the given percentile (0-100), within the precision.
+  uint64_t Percentile(double percentile) const {
+    if (total_ == 0)
+      return 0;
+    uint64_t rank = (uint64_t)(percentile / 100.0 * total_ + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, total_));
+    uint64_t seen = 0;
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+      seen += counts_[i];
+      if (seen >= rank)
+        return std::min(HighestEquivalent(i), max_);
+    }
+    return max_;
+  }
+
+private:
+  static inline int HighestBit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+  }
+
+  static inline int Index(uint64_t value) {
+    if (value < SUB_BUCKET_COUNT)
+      return (int)value;
+    int shift = HighestBit(value) - (SUB_BUCKET_BITS - 1);
+    return (int)(SUB_BUCKET_COUNT + (shift - 1) * SUB_BUCKET_HALF +
+                 ((value >> shift) - SUB_BUCKET_HALF));
+  }
+
+  static inline uint64_t HighestEquivalent(int index) {
+    if (index < (int)SUB_BUCKET_COUNT)
+      return index;
+    int shift = (index - SUB_BUCKET_COUNT) / SUB_BUCKET_HALF + 1;
+    uint64_t sub_bucket = (index - SUB_BUCKET_COUNT) % SUB_BUCKET_HALF + SUB_BUCKET_HALF;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+private:
+  std::vector<uint64_t> counts_;
+  uint64_t total_;
+  uint64_t sum_;
+  uint64_t min_;
+  uint64_t max_;
+};
+
+} // namespace mrpc
+
+#endif // MRPC_HDR_HISTOGRAM_H_
@@ -0,0 +1,372 @@
+/////////////////////////////////////////
+// Load generator: starts a server in this process and drives an "echo"
+// method through asynchronous clients, then prints the QPS and the
+// latency percentiles as JSON.
+//
+// Closed loop (--rate=0): each connection keeps its share of --concurrency
+// calls in flight, and issues the next one when a response arrives.
+// Open loop (--rate=N): N calls per second are issued on a fixed schedule
+// whether the responses have arrived or not, and the latency is measured
+// from the scheduled time, so that a stall is not hidden by the calls it
+// delayed (coordinated omission). --concurrency then bounds the calls in
+// flight, the calls beyond it are counted as dropped.
+//
+// Overload: with --work_us the handler runs on the worker pool and spins
+// for that long, and --timeout_us gives each call a deadline. The qps is
+// the goodput, only the calls answered successfully in time count, the
+// others are counted as expired (the deadline passed on either side),
+// shed (by the admission control of --admission=1) or errors.
+//
+// eg. mrpc_bench --transport=shm --connections=8 --concurrency=128 --payload=256
+//     mrpc_bench --work_us=100 --rate=20000 --concurrency=4096 --timeout_us=20000 --admission=1
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client.h"
+#include "server.h"
+#include "hdr_histogram.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  std::string transport = "tcp";
+  int port = 8090;
+  int server_threads = 1;
+  int client_threads = 1;
+  int connections = 4;
+  int concurrency = 64;
+  int payload = 64;
+  double rate = 0;
+  double duration = 5;
+  double warmup = 1;
+  int work_us = 0;
+  int timeout_us = 0;
+  int admission = 0;
+};
+
+// Shared by the connections of one client thread.
+struct Stats {
+  mrpc::HdrHistogram latency; // ns
+  uint64_t errors = 0;
+  uint64_t expired = 0;
+  uint64_t shed = 0;
+  uint64_t dropped = 0;
+};
+
+// Set by the main thread.
+static std::atomic<bool> g_is_recording(false);
+static std::atomic<bool> g_is_stopping(false);
+
+class Connection {
+public:
+  Connection(asio::io_context &io_context, const Options &options, Stats *stats)
+    : client_(io_context), timer_(io_context), options_(options), stats_(stats),
+      payload_(options.payload, 'x'), num_in_flight_(0), max_in_flight_(0) {
+    client_.set_timeout(std::chrono::microseconds(options.timeout_us));
+  }
+
+  void Connect() {
+    if (options_.transport == "tcp") {
+      std::string host = "127.0.0.1", service = std::to_string(options_.port);
+      client_.Connect(host, service);
+    }
+#ifndef _WIN32
+    else if (options_.transport == "unix") {
+      client_.ConnectLocal(LocalPath(options_));
+    }
+#endif
+#ifdef __linux__
+    else if (options_.transport == "shm") {
+      client_.ConnectShm(ShmPath(options_));
+    }
+#endif
+    else {
+      throw std::runtime_error("Unsupported transport: " + options_.transport);
+    }
+  }
+
+  void StartClosedLoop(int depth) {
+    is_open_loop_ = false;
+    for (int i = 0; i < depth; i++)
+      Issue(Clock::now());
+  }
+
+  void StartOpenLoop(double rate, int max_in_flight) {
+    is_open_loop_ = true;
+    max_in_flight_ = max_in_flight;
+    interval_ = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / rate));
+    next_ = Clock::now();
+    Tick();
+  }
+
+  static std::string LocalPath(const Options &options) {
+    return "/tmp/mrpc_bench_" + std::to_string(options.port) + ".sock";
+  }
+  static std::string ShmPath(const Options &options) {
+    return "/tmp/mrpc_bench_" + std::to_string(options.port) + ".shm";
+  }
+
+private:
+  void Tick() {
+    Clock::time_point now = Clock::now();
+    while (next_ <= now && !g_is_stopping) {
+      Issue(next_);
+      next_ += interval_;
+    }
+    if (g_is_stopping)
+      return;
+    timer_.expires_at(next_);
+    timer_.async_wait([this](std::error_code ec) {
+      if (!ec)
+        Tick();
+    });
+  }
+
+  void Issue(Clock::time_point intended) {
+    if (is_open_loop_ && num_in_flight_ >= max_in_flight_) {
+      if (g_is_recording)
+        stats_->dropped++;
+      return;
+    }
+    num_in_flight_++;
+    client_.AsyncCall<std::vector<char>>(method_id_,
+      [this, intended](mrpc::Response<std::vector<char>> ret) {
+      num_in_flight_--;
+      if (g_is_recording) {
+        if (ret.status == mrpc::STATUS_OK) {
+          stats_->latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - intended).count());
+        }
+        else if (ret.status == mrpc::STATUS_DEADLINE_EXCEEDED) {
+          stats_->expired++;
+        }
+        else if (ret.status == mrpc::STATUS_OVERLOADED) {
+          stats_->shed++;
+        }
+        else {
+          stats_->errors++;
+        }
+      }
+      if (!is_open_loop_ && !g_is_stopping)
+        Issue(Clock::now());
+    }, payload_);
+  }
+
+private:
+  mrpc::Client client_;
+  asio::steady_timer timer_;
+  const Options &options_;
+  Stats *stats_;
+  std::vector<char> payload_;
+  const uint32_t method_id_ = mrpc::MethodId("echo");
+
+  bool is_open_loop_ = false;
+  int num_in_flight_;
+  int max_in_flight_;
+  Clock::duration interval_;
+  Clock::time_point next_;
+};
+
+static void PrintUsage() {
+  Options defaults;
+  printf("Usage: mrpc_bench [--option=value]...\n"
+         "  --transport       tcp, unix or shm (%s)\n"
+         "  --port            TCP port of the local server (%d)\n"
+         "  --server_threads  threads of the server (%d)\n"
+         "  --client_threads  threads driving the connections (%d)\n"
+         "  --connections     number of connections (%d)\n"
+         "  --concurrency     calls in flight in total, the limit in open loop (%d)\n"
+         "  --payload         bytes of the request and of the response (%d)\n"
+         "  --rate            calls per second in total, 0 for closed loop (%g)\n"
+         "  --duration        seconds measured (%g)\n"
+         "  --warmup          seconds before measuring (%g)\n"
+         "  --work_us         spin in the handler on the worker pool, 0 for inline (%d)\n"
+         "  --timeout_us      deadline of each call, 0 for none (%d)\n"
+         "  --admission       1 to shed load by the admission control (%d)\n",
+         defaults.transport.c_str(), defaults.port, defaults.server_threads,
+         defaults.client_threads, defaults.connections, defaults.concurrency,
+         defaults.payload, defaults.rate, defaults.duration, defaults.warmup,
+         defaults.work_us, defaults.timeout_us, defaults.admission);
+}
+
+static bool ParseOptions(int argc, char* argv[], Options *options) {
+  std::map<std::string, std::string> args;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t pos = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || pos == std::string::npos)
+      return false;
+    args[arg.substr(2, pos - 2)] = arg.substr(pos + 1);
+  }
+  for (auto &arg : args) {
+    const std::string &key = arg.first;
+    const char *value = arg.second.c_str();
+    if (key == "transport") options->transport = value;
+    else if (key == "port") options->port = atoi(value);
+    else if (key == "server_threads") options->server_threads = atoi(value);
+    else if (key == "client_threads") options->client_threads = atoi(value);
+    else if (key == "connections") options->connections = atoi(value);
+    else if (key == "concurrency") options->concurrency = atoi(value);
+    else if (key == "payload") options->payload = atoi(value);
+    else if (key == "rate") options->rate = atof(value);
+    else if (key == "duration") options->duration = atof(value);
+    else if (key == "warmup") options->warmup = atof(value);
+    else if (key == "work_us") options->work_us = atoi(value);
+    else if (key == "timeout_us") options->timeout_us = atoi(value);
+    else if (key == "admission") options->admission = atoi(value);
+    else return false;
+  }
+  return options->client_threads > 0 && options->connections > 0 &&
+         options->concurrency > 0 && options->payload >= 0 &&
+         options->rate >= 0 && options->duration > 0;
+}
+
+int main(int argc, char* argv[]) {
+  Options options;
+  if (!ParseOptions(argc, argv, &options)) {
+    PrintUsage();
+    return 1;
+  }
+
+  mrpc::Server server(options.port, options.server_threads);
+  if (options.work_us > 0) {
+    server.SetWorkerPool(std::max(1u, std::thread::hardware_concurrency()), 1024);
+    if (options.admission)
+      server.SetAdmissionControl();
+    std::chrono::microseconds work(options.work_us);
+    server.Bind<std::vector<char>, std::vector<char>>("echo",
+      [work](std::vector<char> &payload) {
+      Clock::time_point end = Clock::now() + work;
+      while (Clock::now() < end) {}
+      return payload;
+    }, mrpc::EXEC_POOL);
+  }
+  else {
+    server.Bind<std::vector<char>, std::vector<char>>("echo",
+      [](std::vector<char> &payload) { return payload; });
+  }
+#ifndef _WIN32
+  if (options.transport == "unix")
+    server.ListenLocal(Connection::LocalPath(options));
+#endif
+#ifdef __linux__
+  if (options.transport == "shm")
+    server.ListenShm(Connection::ShmPath(options));
+#endif
+  std::thread server_thread([&server]() { server.Run(); });
+
+  // Each client thread runs its own io_context with its own stats.
+  std::vector<std::unique_ptr<asio::io_context>> io_contexts;
+  std::vector<Stats> stats(options.client_threads);
+  std::vector<std::unique_ptr<Connection>> connections;
+  for (int i = 0; i < options.client_threads; i++)
+    io_contexts.emplace_back(new asio::io_context(1));
+
+  int exit_code = 0;
+  try {
+    for (int i = 0; i < options.connections; i++) {
+      int t = i % options.client_threads;
+      connections.emplace_back(new Connection(*io_contexts[t], options, &stats[t]));
+      connections.back()->Connect();
+    }
+    // Spread the load over the connections.
+    for (int i = 0; i < options.connections; i++) {
+      int share = options.concurrency / options.connections +
+                  (i < options.concurrency % options.connections ? 1 : 0);
+      if (options.rate == 0)
+        connections[i]->StartClosedLoop(share);
+      else
+        connections[i]->StartOpenLoop(options.rate / options.connections, std::max(share, 1));
+    }
+  }
+  catch (std::exception& e) {
+    fprintf(stderr, "Exception: %s\n", e.what());
+    exit_code = 1;
+    g_is_stopping = true;
+  }
+
+  std::vector<std::thread> client_threads;
+  for (auto &io_context : io_contexts) {
+    asio::io_context *context = io_context.get();
+    client_threads.emplace_back([context]() { context->run(); });
+  }
+
+  Clock::time_point start, end;
+  if (exit_code == 0) {
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.warmup));
+    g_is_recording = true;
+    start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    g_is_recording = false;
+    end = Clock::now();
+    g_is_stopping = true;
+  }
+
+  // The clients return once the calls in flight have completed.
+  for (auto &thread : client_threads)
+    thread.join();
+  connections.clear();
+  server.Stop();
+  server_thread.join();
+  if (exit_code != 0)
+    return exit_code;
+
+  Stats total;
+  for (auto &s : stats) {
+    total.latency.Add(s.latency);
+    total.errors += s.errors;
+    total.expired += s.expired;
+    total.shed += s.shed;
+    total.dropped += s.dropped;
+  }
+  double seconds = std::chrono::duration<double>(end - start).count();
+  const mrpc::HdrHistogram &latency = total.latency;
+  printf("{\n"
+         "  \"transport\": \"%s\",\n"
+         "  \"mode\": \"%s\",\n"
+         "  \"server_threads\": %d,\n"
+         "  \"client_threads\": %d,\n"
+         "  \"connections\": %d,\n"
+         "  \"concurrency\": %d,\n"
+         "  \"payload_bytes\": %d,\n"
+         "  \"target_rate\": %.0f,\n"
+         "  \"work_us\": %d,\n"
+         "  \"timeout_us\": %d,\n"
+         "  \"admission\": %d,\n"
+         "  \"duration_s\": %.3f,\n"
+         "  \"requests\": %llu,\n"
+         "  \"errors\": %llu,\n"
+         "  \"expired\": %llu,\n"
+         "  \"shed\": %llu,\n"
+         "  \"dropped\": %llu,\n"
+         "  \"qps\": %.1f,\n"
+         "  \"latency_us\": {\n"
+         "    \"min\": %.2f,\n"
+         "    \"mean\": %.2f,\n"
+         "    \"p50\": %.2f,\n"
+         "    \"p90\": %.2f,\n"
+         "    \"p99\": %.2f,\n"
+         "    \"p999\": %.2f,\n"
+         "    \"max\": %.2f\n"
+         "  }\n"
+         "}\n",
+         options.transport.c_str(), options.rate == 0 ? "closed" : "open",
+         options.server_threads, options.client_threads, options.connections,
+         options.concurrency, options.payload, options.rate,
+         options.work_us, options.timeout_us, options.admission, seconds,
+         (unsigned long long)latency.count(), (unsigned long long)total.errors,
+         (unsigned long long)total.expired, (unsigned long long)total.shed,
+         (unsigned long long)total.dropped, latency.count() / seconds,
+         latency.min() / 1e3, latency.mean() / 1e3,
+         latency.Percentile(50) / 1e3, latency.Percentile(90) / 1e3,
+         latency.Percentile(99) / 1e3, latency.Percentile(99.9) / 1e3,
+         latency.max() / 1e3);
+  return 0;
+}
@@ -0,0 +1,60 @@
+/////////////////////////////////////////
+// A simple demo for the asynchronous client.
+// A single thread runs the io_context and drives the calls of
+// several connections, the results are delivered to callbacks
+// or futures.
+
+#include <iostream>
+#include <future>
+#include <thread>
+#include "client.h"
+
+int main(int argc, char* argv[]) {
+
+  std::string host = "localhost";
+  std::string service = "8080";
+  asio::io_context io_context;
+
+  try {
+    const int kNumClients = 4;
+    std::vector<std::unique_ptr<mrpc::Client>> clients;
+    for (int i = 0; i < kNumClients; i++) {
+      clients.emplace_back(new mrpc::Client(io_context));
+      clients.back()->Connect(host, service);
+    }
+    std::cout << "Connected to Port " << service << " of " << host << std::endl;
+
+    // Callbacks: fan out to all the connections, and run the io_context
+    // until all of them are completed.
+    for (int i = 0; i < kNumClients; i++) {
+      int A = i;
+      int B = 12;
+      clients[i]->AsyncCall<int>("multiply", 
+        [i](mrpc::Response<int> ret) {
+        std::cout << "AsyncCall(" << i << "): " << ret.value 
+          << ". Info: " << ret.error_str << std::endl;
+      }, A, B);
+    }
+    io_context.run();
+
+    // Futures: the io_context runs on another thread.
+    io_context.restart();
+    auto work = asio::make_work_guard(io_context);
+    std::thread io_thread([&io_context]() { io_context.run(); });
+    {
+      float A = 30.1;
+      float B = 21.2;
+      std::future<mrpc::Response<float>> ret = 
+        clients[0]->AsyncCall<float>("add", asio::use_future, A, B);
+      std::cout << "AsyncCall: A + B = " << A << " + " << B << " = "
+        << ret.get().value << std::endl;
+    }
+    work.reset();
+    io_thread.join();
+  }
+  catch (std::exception& e) {
+    std::cerr << "Exception: " << e.what() << "\n";
+  }
+
+  return 0;
+}
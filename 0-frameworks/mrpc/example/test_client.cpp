@@ -1,10 +1,12 @@
 /////////////////////////////////////////
 // A simple demo for client.
 // Protocol:
-//  Send: "function name", arg1, arg2...
-//  Receive: "function name", ret arg
+//  Send: [header: method id], arg1, arg2...
+//  Receive: [header: method id, status], ret arg
 
 #include <iostream>
+#include <thread>
+#include <chrono>
 #include "client.h"
 
 int main(int argc, char* argv[]) {
@@ -35,7 +37,16 @@ int main(int argc, char* argv[]) {
         std::cout << "Call: A * B = " << A << " * " << B << " = " 
           << ret.value << ". Info: " << ret.error_str << std::endl;
       }
-      Sleep(1000);
+      // Many argument sets in one request.
+      {
+        std::vector<std::tuple<int, int>> args = { {1, 2}, {3, 4}, {5, 6} };
+        auto ret = client.CallMany<int>("multiply", args);
+        std::cout << "CallMany: multiply =";
+        for (int value : ret.value)
+          std::cout << " " << value;
+        std::cout << ". Info: " << ret.error_str << std::endl;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(1000));
     }
   }
   catch (std::exception& e) {
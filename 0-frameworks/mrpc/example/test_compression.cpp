@@ -0,0 +1,158 @@
+/////////////////////////////////////////
+// A check of the built-in LZ codec of Compression.
+// Bodies of different kinds and lengths have to come back unchanged, the
+// compressed ones have to keep the end-of-block rules of LZ4, and
+// truncated or corrupted bodies have to be rejected or decoded to the
+// raw length they declare, without reading or writing out of bounds.
+// Returns the number of failed checks.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "compression.h"
+
+static int num_failed = 0;
+
+static void Check(bool condition, const char *what, size_t length) {
+  if (!condition) {
+    printf("Failed: %s, length %zu.\n", what, length);
+    num_failed++;
+  }
+}
+
+static void SetBody(mrpc::RpcMessage *message, const char *data, size_t length) {
+  mrpc::Buffer body;
+  body.Write(data, length);
+  message->SwapBody(body);
+  message->set_flags(0);
+}
+
+static bool ReadLength(const uint8_t **ip, const uint8_t *end, size_t *n) {
+  uint8_t b;
+  do {
+    if (*ip >= end)
+      return false;
+    b = *(*ip)++;
+    *n += b;
+  } while (b == 255);
+  return true;
+}
+
+// Walk the sequences of an LZ body. A block with a match has to end with
+// at least 5 literals, and its last match has to start at least 12 bytes
+// before the end.
+static bool KeepsLz4Rules(const char *src, size_t src_length, size_t raw_length) {
+  const uint8_t *ip = (const uint8_t *)src;
+  const uint8_t *end = ip + src_length;
+  size_t pos = 0, last_match = 0;
+  bool has_match = false;
+  while (ip < end) {
+    uint8_t token = *ip++;
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !ReadLength(&ip, end, &literal_length))
+      return false;
+    if (literal_length > (size_t)(end - ip))
+      return false;
+    ip += literal_length;
+    pos += literal_length;
+    if (ip == end)
+      return pos == raw_length && (!has_match || (literal_length >= 5 && last_match + 12 <= raw_length));
+
+    if (end - ip < 2)
+      return false;
+    ip += 2;
+    size_t match_length = token & 15;
+    if (match_length == 15 && !ReadLength(&ip, end, &match_length))
+      return false;
+    has_match = true;
+    last_match = pos;
+    pos += match_length + 4;
+  }
+  return false;
+}
+
+static std::vector<char> MakePayload(int kind, size_t length, std::mt19937 &rng) {
+  std::vector<char> data(length);
+  for (size_t i = 0; i < length; i++) {
+    switch (kind) {
+    case 0: data[i] = 0; break;                                // One long run.
+    case 1: data[i] = "mrpc-lz"[i % 7]; break;                 // A short period.
+    case 2: data[i] = "abcd"[rng() % 4]; break;                // A small alphabet.
+    case 3: data[i] = (char)(i / 64 + (rng() % 32 == 0)); break; // Steps with noise.
+    default: data[i] = (char)rng(); break;                     // Incompressible.
+    }
+  }
+  return data;
+}
+
+static void RoundTrip(mrpc::Compression &compression, const std::vector<char> &data, std::mt19937 &rng) {
+  mrpc::RpcMessage message;
+  mrpc::Buffer scratch;
+  SetBody(&message, data.data(), data.size());
+  if (!compression.Compress(&message, &scratch)) {
+    Check(message.body_length() == data.size() &&
+          memcmp(message.body(), data.data(), data.size()) == 0, "body changed without compression", data.size());
+    return;
+  }
+  Check(message.body_length() < data.size(), "not smaller", data.size());
+  Check(KeepsLz4Rules(message.body() + mrpc::Compression::PREFIX_SIZE,
+                      message.body_length() - mrpc::Compression::PREFIX_SIZE, data.size()),
+        "LZ4 end-of-block rules", data.size());
+  std::vector<char> compressed(message.body(), message.body() + message.body_length());
+
+  Check(compression.Decompress(&message, &scratch), "decompress", data.size());
+  Check(message.body_length() == data.size() &&
+        memcmp(message.body(), data.data(), data.size()) == 0, "round trip", data.size());
+
+  // Corrupted copies: truncated, with bytes changed, with a wrong raw length.
+  for (int i = 0; i < 32; i++) {
+    std::vector<char> corrupted = compressed;
+    if (i % 3 == 0) {
+      corrupted.resize(rng() % corrupted.size());
+    }
+    else if (i % 3 == 1) {
+      for (int j = 0; j < 1 + i / 8; j++) {
+        size_t at = mrpc::Compression::PREFIX_SIZE + rng() % (corrupted.size() - mrpc::Compression::PREFIX_SIZE);
+        corrupted[at] = (char)rng();
+      }
+    }
+    else {
+      uint64_t raw_length = rng() % (2 * data.size() + 1);
+      memcpy(corrupted.data() + 1, &raw_length, sizeof(raw_length));
+    }
+    SetBody(&message, corrupted.data(), corrupted.size());
+    message.set_flags(mrpc::FLAG_COMPRESSED);
+    uint64_t declared = 0;
+    if (corrupted.size() >= mrpc::Compression::PREFIX_SIZE)
+      memcpy(&declared, corrupted.data() + 1, sizeof(declared));
+    if (compression.Decompress(&message, &scratch))
+      Check(message.body_length() == declared, "length of a corrupted body", data.size());
+  }
+}
+
+int main(int argc, char* argv[]) {
+  mrpc::CompressionOptions options;
+  options.codec = mrpc::CODEC_LZ;
+  options.threshold = 0;
+  mrpc::Compression compression(options);
+
+  std::mt19937 rng(11);
+  std::vector<size_t> lengths = { 10, 12, 13, 16, 17, 18, 20, 31, 64, 255, 256, 270, 4096, 65536, 65536 + 300, 200000 };
+  for (int i = 0; i < 200; i++)
+    lengths.push_back(10 + rng() % 5000);
+
+  int num_checked = 0;
+  for (size_t length : lengths) {
+    for (int kind = 0; kind < 5; kind++) {
+      RoundTrip(compression, MakePayload(kind, length, rng), rng);
+      num_checked++;
+    }
+  }
+  mrpc::CompressionStats stats = compression.stats();
+  printf("%d bodies, %llu compressed, %d failed checks.\n", num_checked,
+    (unsigned long long)stats.frames_compressed, num_failed);
+  return num_failed;
+}
@@ -0,0 +1,64 @@
+/////////////////////////////////////////
+// A demo of the coroutine handlers, which requires C++20.
+// A single thread runs one io_context for both the server and a client
+// connected back to it. "norm2" makes nested calls to "square" through
+// the client, and "distance2" calls "norm2" in turn. With blocking calls
+// this would deadlock on one thread, here each handler is suspended
+// while its nested calls are in flight, and the thread keeps serving.
+
+#include <iostream>
+#include <stdexcept>
+#include "client.h"
+#include "server.h"
+
+#if defined(ASIO_HAS_CO_AWAIT)
+
+int main(int argc, char* argv[]) {
+  short port = 8085;
+  asio::io_context io_context;
+
+  mrpc::Server server(io_context, port);
+  mrpc::Client client(io_context);
+
+  server.Bind<int, int>("square", [](int &x) { return x * x; });
+  server.Bind<asio::awaitable<int>, int, int>("norm2",
+    [&client](int &x, int &y) -> asio::awaitable<int> {
+    mrpc::Response<int> xx = co_await client.CoCall<int>("square", x);
+    mrpc::Response<int> yy = co_await client.CoCall<int>("square", y);
+    co_return xx.value + yy.value;
+  });
+  server.Bind<asio::awaitable<int>, int, int, int, int>("distance2",
+    [&client](int &x0, int &y0, int &x1, int &y1) -> asio::awaitable<int> {
+    int dx = x1 - x0, dy = y1 - y0;
+    mrpc::Response<int> ret = co_await client.CoCall<int>("norm2", dx, dy);
+    if (ret.status != mrpc::STATUS_OK)
+      throw std::runtime_error(ret.error_str);
+    co_return ret.value;
+  });
+
+  std::string host = "127.0.0.1", service = std::to_string(port);
+  client.Connect(host, service);
+
+  asio::co_spawn(io_context, [&]() -> asio::awaitable<void> {
+    for (int i = 0; i < 4; i++) {
+      int x0 = 0, y0 = 0, x1 = 3 * i, y1 = 4 * i;
+      mrpc::Response<int> ret = co_await client.CoCall<int>("distance2", x0, y0, x1, y1);
+      std::cout << "distance2((0, 0), (" << x1 << ", " << y1 << ")) = "
+        << ret.value << ". Info: " << ret.error_str << std::endl;
+    }
+    client.Close();
+    io_context.stop();
+  }, asio::detached);
+
+  io_context.run();
+  return 0;
+}
+
+#else
+
+int main(int argc, char* argv[]) {
+  std::cout << "The coroutine handlers require C++20, see MRPC_USE_CXX20." << std::endl;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,60 @@
+#include "admission.h"
+
+#include <algorithm>
+
+namespace mrpc {
+
+AdmissionController::AdmissionController(const AdmissionOptions &options)
+  : options_(options), in_flight_(0), limit_(options.max_limit),
+    min_delay_(UINT64_MAX), interval_end_(0), is_limited_(false) {
+  options_.min_limit = std::max(1, options_.min_limit);
+  options_.max_limit = std::max(options_.min_limit, options_.max_limit);
+  limit_ = options_.max_limit;
+}
+
+bool AdmissionController::TryAdmit() {
+  int n = in_flight_.fetch_add(1, std::memory_order_relaxed);
+  if (n >= limit_.load(std::memory_order_relaxed)) {
+    in_flight_.fetch_sub(1, std::memory_order_relaxed);
+    is_limited_.store(true, std::memory_order_relaxed);
+    return false;
+  }
+  return true;
+}
+
+void AdmissionController::OnFinish() {
+  in_flight_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void AdmissionController::OnStart(uint64_t queue_delay) {
+  uint64_t min_delay = min_delay_.load(std::memory_order_relaxed);
+  while (queue_delay < min_delay &&
+         !min_delay_.compare_exchange_weak(min_delay, queue_delay, std::memory_order_relaxed)) {}
+
+  int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    Clock::now().time_since_epoch()).count();
+  int64_t end = interval_end_.load(std::memory_order_relaxed);
+  if (now < end)
+    return;
+  // Only one of the threads closes the interval.
+  int64_t next = now + std::chrono::duration_cast<std::chrono::nanoseconds>(options_.interval).count();
+  if (interval_end_.compare_exchange_strong(end, next, std::memory_order_relaxed))
+    Adjust(min_delay_.exchange(UINT64_MAX, std::memory_order_relaxed));
+}
+
+void AdmissionController::Adjust(uint64_t min_delay) {
+  uint64_t target = std::chrono::duration_cast<std::chrono::nanoseconds>(options_.target_delay).count();
+  int limit = limit_.load(std::memory_order_relaxed);
+  bool is_limited = is_limited_.exchange(false, std::memory_order_relaxed);
+  if (min_delay != UINT64_MAX && min_delay > target) {
+    // From the calls in flight, the limit may be far above them.
+    limit = std::min(limit, in_flight_.load(std::memory_order_relaxed));
+    limit = std::max(options_.min_limit, limit - std::max(1, limit / 10));
+  }
+  else if (is_limited) {
+    limit = std::min(options_.max_limit, limit + std::max(1, limit / 10));
+  }
+  limit_.store(limit, std::memory_order_relaxed);
+}
+
+} // namespace mrpc
@@ -0,0 +1,61 @@
+#ifndef MRPC_ADMISSION_H_
+#define MRPC_ADMISSION_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace mrpc {
+
+struct AdmissionOptions {
+  // The queueing delay on the worker pool that is tolerated.
+  std::chrono::microseconds target_delay{5000};
+  // How often the limit is adjusted.
+  std::chrono::milliseconds interval{100};
+  // Bounds of the number of calls admitted at the same time.
+  int min_limit = 1;
+  int max_limit = 1024;
+};
+
+// Adaptive limit of the calls admitted to the worker pool, queued or
+// running, so that an overloaded server sheds the excess right away
+// instead of letting its queue grow until every call is late.
+//
+// As in CoDel, the minimum queueing delay seen during an interval tells
+// whether there is a standing queue, the bursts that drain within the
+// interval do not count. If it is above the target the limit is cut to
+// 90% of the calls in flight, and if the limit has been reached without
+// such a queue it grows by 10%. It is lock-free, and shared by the
+// threads of a server.
+class AdmissionController {
+  typedef std::chrono::steady_clock Clock;
+
+public:
+  AdmissionController(const AdmissionOptions &options);
+
+  // Returns false if the call should be shed.
+  bool TryAdmit();
+  // An admitted call starts running after waiting queue_delay ns.
+  void OnStart(uint64_t queue_delay);
+  // An admitted call has finished, or has not been queued after all.
+  void OnFinish();
+
+  inline int limit() const { return limit_.load(std::memory_order_relaxed); }
+  inline int in_flight() const { return in_flight_.load(std::memory_order_relaxed); }
+
+private:
+  void Adjust(uint64_t min_delay);
+
+private:
+  AdmissionOptions options_;
+  std::atomic<int> in_flight_;
+  std::atomic<int> limit_;
+  // The state of the current interval.
+  std::atomic<uint64_t> min_delay_;
+  std::atomic<int64_t> interval_end_; // ns of Clock.
+  std::atomic<bool> is_limited_;
+};
+
+} // namespace mrpc
+
+#endif // MRPC_ADMISSION_H_
@@ -0,0 +1,57 @@
+#include "buffer.h"
+
+#include <new>
+#include <utility>
+
+namespace mrpc {
+
+Buffer::Buffer() 
+  : data_(nullptr), size_(0), capacity_(0), read_pos_(0), 
+    good_(true), is_compact_(false) {}
+
+Buffer::~Buffer() { Release(); }
+
+void Buffer::Release() {
+  if (data_ != nullptr) {
+    free(data_);
+    data_ = nullptr;
+  }
+  size_ = 0;
+  capacity_ = 0;
+  Rewind();
+}
+
+void Buffer::Compact() {
+  if (read_pos_ == 0)
+    return;
+  size_t n = remaining();
+  if (n > 0)
+    memmove(data_, data_ + read_pos_, n);
+  size_ = n;
+  read_pos_ = 0;
+}
+
+void Buffer::Swap(Buffer &other) {
+  std::swap(data_, other.data_);
+  std::swap(size_, other.size_);
+  std::swap(capacity_, other.capacity_);
+  std::swap(read_pos_, other.read_pos_);
+  std::swap(good_, other.good_);
+  std::swap(is_compact_, other.is_compact_);
+}
+
+void Buffer::Grow(size_t min_capacity) {
+  // Double the capacity to keep the amortized cost of appending constant.
+  size_t new_capacity = capacity_ < INIT_CAPACITY ? INIT_CAPACITY : capacity_;
+  while (new_capacity < min_capacity)
+    new_capacity *= 2;
+
+  char *new_data = (char *)realloc(data_, new_capacity);
+  if (new_data == nullptr)
+    throw std::bad_alloc();
+
+  data_ = new_data;
+  capacity_ = new_capacity;
+}
+
+} // namespace mrpc
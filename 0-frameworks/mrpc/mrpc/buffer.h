@@ -0,0 +1,116 @@
+#ifndef MRPC_BUFFER_H_
+#define MRPC_BUFFER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+namespace mrpc {
+
+// Contiguous byte buffer used as the serialization target.
+// Writes append at the tail and reads consume from a separate cursor.
+// The storage grows geometrically and is kept across Clear(), so a
+// buffer owned by a session is reused for every message on it.
+class Buffer {
+  const static size_t INIT_CAPACITY = 256;
+
+public:
+  Buffer();
+  ~Buffer();
+
+  Buffer(const Buffer &) = delete;
+  Buffer &operator=(const Buffer &) = delete;
+
+  inline char *data() const { return data_; }
+  inline size_t size() const { return size_; }
+  inline size_t capacity() const { return capacity_; }
+  // The number of bytes that have not been read yet.
+  inline size_t remaining() const { return size_ - read_pos_; }
+  inline size_t read_pos() const { return read_pos_; }
+  // False once a read has run past the end of the written data.
+  inline bool good() const { return good_; }
+
+  // The wire encoding of the integers, see Serializer::Varint.
+  inline bool is_compact() const { return is_compact_; }
+  inline void set_compact(bool is_compact) { is_compact_ = is_compact; }
+
+  // Drop the content, but keep the storage.
+  inline void Clear() { size_ = 0; Rewind(); }
+  // Drop the content, and free the storage if it is larger than
+  // max_capacity, eg. after a rare large message on a pooled buffer.
+  inline void Trim(size_t max_capacity) {
+    if (capacity_ > max_capacity)
+      Release();
+    Clear();
+  }
+  // Restart reading from the beginning.
+  inline void Rewind() { read_pos_ = 0; good_ = true; }
+  // Mark the content as malformed, eg. a length larger than what is left.
+  inline void Fail() { read_pos_ = size_; good_ = false; }
+
+  // Make sure that n more bytes can be written without growing.
+  inline void Reserve(size_t n) {
+    if (size_ + n > capacity_) { Grow(size_ + n); }
+  }
+  // Set the size of the content directly, e.g. before receiving
+  // n bytes from the socket into data(). The old content is not kept.
+  inline void Resize(size_t n) {
+    if (n > capacity_) { Release(); Grow(n); }
+    size_ = n;
+    Rewind();
+  }
+
+  // For receiving from the socket into the tail directly:
+  // Reserve() the space, read into tail() and then Commit() the length.
+  inline char *tail() const { return data_ + size_; }
+  inline size_t tail_room() const { return capacity_ - size_; }
+  inline void Commit(size_t n) { size_ += n; }
+  // Move the unread bytes to the front to make room at the tail.
+  void Compact();
+  // Exchange the content and the storage with another buffer.
+  void Swap(Buffer &other);
+
+  inline void Write(const void *src, size_t n) {
+    if (n == 0) { return; }
+    Reserve(n);
+    memcpy(data_ + size_, src, n);
+    size_ += n;
+  }
+  inline bool Read(void *dst, size_t n) {
+    if (n > remaining()) {
+      memset(dst, 0, n);
+      Fail();
+      return false;
+    }
+    memcpy(dst, data_ + read_pos_, n);
+    read_pos_ += n;
+    return true;
+  }
+
+  // Take n bytes in place without copying, for the views that point
+  // into this buffer. Returns nullptr if there are not enough bytes.
+  inline const char *Consume(size_t n) {
+    if (n > remaining()) {
+      Fail();
+      return nullptr;
+    }
+    const char *p = data_ + read_pos_;
+    read_pos_ += n;
+    return p;
+  }
+
+private:
+  void Grow(size_t min_capacity);
+  void Release();
+
+private:
+  char *data_;
+  size_t size_;
+  size_t capacity_;
+  size_t read_pos_;
+  bool good_;
+  bool is_compact_;
+};
+
+} // namespace mrpc
+#endif // MRPC_BUFFER_H_
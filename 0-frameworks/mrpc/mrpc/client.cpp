@@ -0,0 +1,419 @@
+#include "client.h"
+
+namespace mrpc {
+
+void Client::Connect(std::string &host, std::string &service) {
+  asio::ip::tcp::socket socket(io_context_);
+  asio::connect(socket, resolver_.resolve(host, service)); // <host> <port>
+  // Small requests should not wait for the acks of the previous ones.
+  socket.set_option(asio::ip::tcp::no_delay(true));
+  transport_.reset(new TcpTransport(std::move(socket)));
+}
+
+void Client::AsyncConnect(const std::string &host, const std::string &service,
+                          std::chrono::milliseconds timeout,
+                          std::function<void(std::error_code)> handler) {
+  // Shared with the timer, whose handler may run after the client is gone.
+  auto resolver = std::make_shared<asio::ip::tcp::resolver>(io_context_);
+  auto socket = std::make_shared<asio::ip::tcp::socket>(io_context_);
+  auto timer = std::make_shared<asio::steady_timer>(io_context_, timeout);
+  auto is_timed_out = std::make_shared<bool>(false);
+  timer->async_wait([resolver, socket, is_timed_out](std::error_code ec) {
+    if (ec)
+      return;
+    *is_timed_out = true;
+    resolver->cancel();
+    asio::error_code close_ec;
+    socket->close(close_ec);
+  });
+
+  auto finish = [timer, is_timed_out, handler](std::error_code ec) {
+    timer->cancel();
+    if (*is_timed_out)
+      ec = std::make_error_code(std::errc::timed_out);
+    handler(ec);
+  };
+  resolver->async_resolve(host, service,
+    [this, resolver, socket, is_timed_out, finish](std::error_code ec,
+                                                   asio::ip::tcp::resolver::results_type endpoints) {
+    if (ec || *is_timed_out) {
+      finish(ec);
+      return;
+    }
+    asio::async_connect(*socket, endpoints,
+      [this, socket, is_timed_out, finish](std::error_code ec, const asio::ip::tcp::endpoint &) {
+      if (!ec && !*is_timed_out) {
+        asio::error_code option_ec;
+        socket->set_option(asio::ip::tcp::no_delay(true), option_ec);
+        transport_.reset(new TcpTransport(std::move(*socket)));
+      }
+      finish(ec);
+    });
+  });
+}
+
+#ifndef _WIN32
+void Client::ConnectLocal(const std::string &path) {
+  asio::local::stream_protocol::socket socket(io_context_);
+  socket.connect(asio::local::stream_protocol::endpoint(path));
+  transport_.reset(new LocalTransport(std::move(socket)));
+}
+#endif
+
+#ifdef __linux__
+void Client::ConnectShm(const std::string &path) {
+  asio::local::stream_protocol::socket socket(io_context_);
+  socket.connect(asio::local::stream_protocol::endpoint(path));
+  transport_ = ShmTransport::Connect(std::move(socket));
+}
+#endif
+
+void Client::Close() {
+  if (transport_ != nullptr)
+    transport_->close();
+  Abort();
+}
+
+RpcMessage *Client::AcquireMessage() {
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  if (free_messages_.empty()) {
+    messages_.emplace_back(new RpcMessage);
+    return messages_.back().get();
+  }
+  RpcMessage *message = free_messages_.back();
+  free_messages_.pop_back();
+  return message;
+}
+
+void Client::ReleaseMessage(RpcMessage *message) {
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  free_messages_.push_back(message);
+}
+
+RpcMessage *Client::ReadFrame() {
+  while (inbound_.remaining() < sizeof(FrameHeader)) {
+    inbound_.Compact();
+    inbound_.Reserve(READ_SIZE);
+    inbound_.Commit(transport_->read_some(asio::buffer(inbound_.tail(), inbound_.tail_room())));
+  }
+  RpcMessage *message = AcquireMessage();
+  inbound_.Read(message->header(), message->header_length());
+  if (!message->UnpackHeader()) {
+    ReleaseMessage(message);
+    return nullptr;
+  }
+  message->AppendBody(inbound_);
+  while (message->body_missing() > 0) {
+    size_t length;
+    char *data = message->PrepareBody(&length);
+    transport_->read(asio::buffer(data, length));
+    message->CommitBody(length);
+  }
+  if (!Inflate(message)) {
+    ReleaseMessage(message);
+    return nullptr;
+  }
+  return message;
+}
+
+RpcMessage *Client::ReadFrame(uint64_t request_id) {
+  while (true) {
+    RpcMessage *message = ReadFrame();
+    if (message == nullptr || message->request_id() == request_id)
+      return message;
+    arrived_[message->request_id()] = message;
+  }
+}
+
+void Client::WriteMessage(RpcMessage &message) {
+  Deflate(&message);
+  sync_buffers_.clear();
+  sync_buffers_.push_back(asio::buffer(message.header(), message.header_length()));
+  sync_buffers_.push_back(asio::buffer(message.body(), message.body_length()));
+  transport_->write(sync_buffers_);
+}
+
+void Client::Deflate(RpcMessage *message) {
+  if (compression_ == nullptr)
+    return;
+  message->set_flags(message->flags() | FLAG_ACCEPT_COMPRESSION);
+  if (peer_accepts_compression_)
+    compression_->Compress(message, &compress_buffer_);
+}
+
+bool Client::Inflate(RpcMessage *message) {
+  if (message->flags() & FLAG_ACCEPT_COMPRESSION) {
+    peer_accepts_compression_ = true;
+    message->set_flags(message->flags() & ~FLAG_ACCEPT_COMPRESSION);
+  }
+  if (!(message->flags() & FLAG_COMPRESSED))
+    return true;
+  return compression_ != nullptr && compression_->Decompress(message, &compress_buffer_);
+}
+
+void Client::SendCredit(uint64_t request_id, uint32_t method_id, uint32_t credits) {
+  RpcMessage message;
+  message.set_request_id(request_id);
+  message.set_method_id(method_id);
+  message.set_status(STATUS_OK);
+  message.set_flags(FLAG_CREDIT);
+  message.Pack(credits);
+  WriteMessage(message);
+}
+
+////////////////////////
+// Asynchronous calls.
+////////////////////////
+void Client::StartCall(RpcMessage *message, std::unique_ptr<PendingCall> call) {
+  pending_calls_[message->request_id()] = std::move(call);
+  if (message->timeout_us() > 0) {
+    deadlines_.emplace(std::chrono::steady_clock::now() + 
+      std::chrono::microseconds(message->timeout_us()), message->request_id());
+    ArmDeadlineTimer();
+  }
+  if (is_batching_) {
+    AddToBatch(message);
+  }
+  else {
+    write_queue_.push_back(message);
+    if (writing_.empty())
+      do_write();
+  }
+  if (!is_reading_)
+    do_read();
+}
+
+void Client::do_write() {
+  // Gather the queued requests into a single write.
+  write_buffers_.clear();
+  while (!write_queue_.empty() && writing_.size() < MAX_GATHER) {
+    RpcMessage *message = write_queue_.front();
+    write_queue_.pop_front();
+    Deflate(message);
+    writing_.push_back(message);
+    write_buffers_.push_back(asio::buffer(message->header(), message->header_length()));
+    write_buffers_.push_back(asio::buffer(message->body(), message->body_length()));
+  }
+
+  num_writes_++;
+  transport_->async_write(write_buffers_,
+    [this](std::error_code ec, std::size_t /*length*/) {
+    for (auto message : writing_) {
+      ReleaseMessage(message);
+    }
+    writing_.clear();
+    if (ec) {
+      Abort();
+      return;
+    }
+    if (!write_queue_.empty())
+      do_write();
+  });
+}
+
+void Client::do_read() {
+  // Stop reading when nothing is in flight, so that io_context.run()
+  // can return once all the calls have been completed.
+  if (pending_calls_.empty()) {
+    is_reading_ = false;
+    return;
+  }
+  is_reading_ = true;
+  inbound_.Compact();
+  inbound_.Reserve(READ_SIZE);
+
+  num_reads_++;
+  transport_->async_read_some(asio::buffer(inbound_.tail(), inbound_.tail_room()),
+    [this](std::error_code ec, std::size_t length) {
+    if (ec) {
+      Abort();
+      return;
+    }
+    inbound_.Commit(length);
+    do_parse();
+  });
+}
+
+void Client::do_parse() {
+  while (inbound_.remaining() >= sizeof(FrameHeader)) {
+    RpcMessage *message = AcquireMessage();
+    inbound_.Read(message->header(), message->header_length());
+    if (!message->UnpackHeader()) {
+      ReleaseMessage(message);
+      Abort();
+      return;
+    }
+    message->AppendBody(inbound_);
+    if (message->body_missing() > 0) {
+      do_read_body(message);
+      return;
+    }
+    if (!Inflate(message)) {
+      ReleaseMessage(message);
+      Abort();
+      return;
+    }
+    Complete(message);
+  }
+  do_read();
+}
+
+void Client::do_read_body(RpcMessage *message) {
+  num_reads_++;
+  size_t length;
+  char *data = message->PrepareBody(&length);
+  transport_->async_read(asio::buffer(data, length),
+    [this, message, length](std::error_code ec, std::size_t /*length*/) {
+    if (!ec) {
+      message->CommitBody(length);
+      if (message->body_missing() > 0) {
+        do_read_body(message);
+        return;
+      }
+    }
+    if (ec || !Inflate(message)) {
+      ReleaseMessage(message);
+      Abort();
+      return;
+    }
+    Complete(message);
+    do_parse();
+  });
+}
+
+void Client::Complete(RpcMessage *message) {
+  if (message->flags() & FLAG_BATCH) {
+    CompleteBatch(message);
+    return;
+  }
+  auto iter = pending_calls_.find(message->request_id());
+  if (iter != pending_calls_.end()) {
+    std::unique_ptr<PendingCall> call = std::move(iter->second);
+    pending_calls_.erase(iter);
+    call->Complete(message);
+  }
+  ReleaseMessage(message);
+  // Do not hold the io_context until the deadlines of the completed calls.
+  if (pending_calls_.empty() && is_deadline_armed_) {
+    deadlines_.clear();
+    is_deadline_armed_ = false;
+    deadline_timer_.cancel();
+  }
+}
+
+void Client::CompleteBatch(RpcMessage *message) {
+  message->Ready4Unpack();
+  while (message->buffer().remaining() > 0) {
+    RpcMessage *response = AcquireMessage();
+    if (!message->NextFrame(response)) {
+      ReleaseMessage(response);
+      break;
+    }
+    // Batches are not nested, the server refuses them.
+    response->set_flags(response->flags() & ~FLAG_BATCH);
+    Complete(response);
+  }
+  ReleaseMessage(message);
+}
+
+void Client::AddToBatch(RpcMessage *message) {
+  if (message->body_length() + message->header_length() >= batch_options_.max_bytes) {
+    // Not worth copying, send it alone after the calls before it.
+    FlushBatch();
+    write_queue_.push_back(message);
+    if (writing_.empty())
+      do_write();
+    return;
+  }
+
+  if (batch_ == nullptr) {
+    batch_ = AcquireMessage();
+    batch_->set_request_id(++request_id_);
+    batch_->set_method_id(0);
+    batch_->InitBatch();
+    batch_calls_ = 0;
+
+    uint64_t batch_id = batch_->request_id();
+    batch_timer_.expires_after(batch_options_.window);
+    batch_timer_.async_wait([this, batch_id](std::error_code ec) {
+      // The client may be gone if it has been cancelled.
+      if (!ec && batch_ != nullptr && batch_->request_id() == batch_id)
+        FlushBatch();
+    });
+  }
+  batch_->AppendFrame(*message);
+  ReleaseMessage(message);
+  if (++batch_calls_ >= batch_options_.max_calls || 
+      batch_->body_length() >= batch_options_.max_bytes) {
+    FlushBatch();
+  }
+}
+
+void Client::FlushBatch() {
+  if (batch_ == nullptr)
+    return;
+  write_queue_.push_back(batch_);
+  batch_ = nullptr;
+  batch_timer_.cancel();
+  if (writing_.empty())
+    do_write();
+}
+
+void Client::ArmDeadlineTimer() {
+  if (deadlines_.empty())
+    return;
+  auto earliest = deadlines_.begin()->first;
+  if (is_deadline_armed_ && deadline_expiry_ <= earliest)
+    return;
+  is_deadline_armed_ = true;
+  deadline_expiry_ = earliest;
+  deadline_timer_.expires_at(earliest);
+  deadline_timer_.async_wait([this](std::error_code ec) {
+    // Cancelled by an earlier deadline, or the client is gone.
+    if (ec)
+      return;
+    is_deadline_armed_ = false;
+    ExpireCalls();
+  });
+}
+
+void Client::ExpireCalls() {
+  auto now = std::chrono::steady_clock::now();
+  while (!deadlines_.empty() && deadlines_.begin()->first <= now) {
+    uint64_t request_id = deadlines_.begin()->second;
+    deadlines_.erase(deadlines_.begin());
+    auto iter = pending_calls_.find(request_id);
+    if (iter == pending_calls_.end())
+      continue;
+    // A late response is dropped by Complete().
+    std::unique_ptr<PendingCall> call = std::move(iter->second);
+    pending_calls_.erase(iter);
+    call->Fail(STATUS_DEADLINE_EXCEEDED, "The deadline has passed.");
+  }
+  ArmDeadlineTimer();
+}
+
+void Client::Abort() {
+  is_reading_ = false;
+  if (batch_ != nullptr) {
+    ReleaseMessage(batch_);
+    batch_ = nullptr;
+    batch_timer_.cancel();
+  }
+  deadlines_.clear();
+  if (is_deadline_armed_) {
+    is_deadline_armed_ = false;
+    deadline_timer_.cancel();
+  }
+  std::unordered_map<uint64_t, std::unique_ptr<PendingCall>> calls;
+  calls.swap(pending_calls_);
+  for (auto &call : calls) {
+    call.second->Complete(nullptr);
+  }
+  for (auto message : write_queue_) {
+    ReleaseMessage(message);
+  }
+  write_queue_.clear();
+}
+
+} // namespace mrpc
@@ -1,69 +1,570 @@
 #ifndef MRPC_CLIENT_H_
 #define MRPC_CLIENT_H_
 
+#include <array>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include "asio.hpp"
+#include "compression.h"
 #include "message.h"
+#include "shm_transport.h"
+#include "transport.h"
 
 namespace mrpc {
 
 template<typename T>
 struct Response {
+  StatusCode status;
   T value;
   std::string error_str;
 };
 
+// A batch is sent when it has max_calls calls or max_bytes bytes, or
+// window after its first call. With a zero window, it takes the calls
+// that are already queued on the io_context.
+struct BatchOptions {
+  size_t max_calls = 64;
+  size_t max_bytes = 16 * 1024;
+  std::chrono::microseconds window{50};
+};
+
 class Client {
+  typedef asio::io_context::executor_type executor_type;
+
+  // Free space for each read from the socket.
+  const static size_t READ_SIZE = 64 * 1024;
+  // The maximum number of requests gathered into one write.
+  const static size_t MAX_GATHER = 64;
+
+  // A call issued by AsyncCall() that is waiting for its response.
+  class PendingCall {
+  public:
+    PendingCall(uint32_t method_id) : method_id_(method_id) {}
+    virtual ~PendingCall() {}
+    // message is nullptr if the connection failed.
+    virtual void Complete(RpcMessage *message) = 0;
+    // Complete it without a response, eg. when its deadline has passed.
+    virtual void Fail(StatusCode status, const std::string &error_str) = 0;
+
+  protected:
+    uint32_t method_id_;
+  };
+
+  template <typename RespT, typename Handler>
+  class DerivedPendingCall : public PendingCall {
+  public:
+    DerivedPendingCall(uint32_t method_id, Handler &&handler, const executor_type &ex)
+      : PendingCall(method_id), handler_(std::move(handler)),
+        work_(asio::get_associated_executor(handler_, ex)) {}
+
+    virtual void Complete(RpcMessage *message) {
+      if (message == nullptr) {
+        Fail(STATUS_IO_ERROR, "Connection failed.");
+        return;
+      }
+      Response<RespT> ret;
+      Client::UnpackResponse(*message, method_id_, ret);
+      Finish(std::move(ret));
+    }
+
+    virtual void Fail(StatusCode status, const std::string &error_str) {
+      Response<RespT> ret;
+      ret.status = status;
+      ret.value = RespT();
+      ret.error_str = error_str;
+      Finish(std::move(ret));
+    }
+
+  private:
+    void Finish(Response<RespT> ret) {
+      // Invoke the handler on its own executor, eg. the one of a coroutine.
+      auto ex = work_.get_executor();
+      asio::dispatch(ex, 
+        [handler = std::move(handler_), ret = std::move(ret)]() mutable {
+        handler(std::move(ret));
+      });
+      work_.reset();
+    }
+
+  private:
+    Handler handler_;
+    asio::executor_work_guard<asio::associated_executor_t<Handler, executor_type>> work_;
+  };
+
 public:
   Client(asio::io_context& io_context):
-    socket_(io_context),
-    resolver_(io_context) {}
+    io_context_(io_context),
+    resolver_(io_context),
+    request_id_(0),
+    is_compact_(false),
+    stream_window_(16),
+    timeout_(0),
+    is_reading_(false),
+    is_batching_(false),
+    batch_(nullptr),
+    batch_calls_(0),
+    batch_timer_(io_context),
+    deadline_timer_(io_context),
+    is_deadline_armed_(false),
+    peer_accepts_compression_(false),
+    num_reads_(0),
+    num_writes_(0) {}
 
   ~Client() {}
 
-  inline void Connect(std::string &host, std::string &service) {
-    asio::connect(socket_, resolver_.resolve(host, service)); // <host> <port>
+  void Connect(std::string &host, std::string &service);
+  // Connect without blocking the thread. The handler is called on the
+  // thread of the io_context, with std::errc::timed_out if it takes longer
+  // than timeout. Start it on that thread too.
+  void AsyncConnect(const std::string &host, const std::string &service,
+                    std::chrono::milliseconds timeout,
+                    std::function<void(std::error_code)> handler);
+#ifndef _WIN32
+  // For a server on the same host, see Server::ListenLocal().
+  void ConnectLocal(const std::string &path);
+#endif
+#ifdef __linux__
+  // For a server on the same host, see Server::ListenShm().
+  void ConnectShm(const std::string &path);
+#endif
+
+  // Close the connection, the asynchronous calls in flight complete with
+  // STATUS_IO_ERROR. Call it on the thread of the io_context, and keep
+  // the client alive until the handlers posted by it have run.
+  void Close();
+
+  // Use the compact encoding (varints for the integers) for the requests
+  // on this connection, and the server answers in the same encoding.
+  // It suits the messages that are mostly small ids and counts.
+  inline void set_compact(bool is_compact) { is_compact_ = is_compact; }
+
+  // The timeout of the calls made after it, 0 (by default) for none. It
+  // is carried in the request, and the server answers the calls that are
+  // not run in time with STATUS_DEADLINE_EXCEEDED instead of running
+  // them late. An asynchronous call also completes with it on the client
+  // once the timeout has passed, whether the server has answered or not.
+  inline void set_timeout(std::chrono::microseconds timeout) { timeout_ = timeout; }
+  inline std::chrono::microseconds timeout() const { return timeout_; }
+
+  // Pack the small asynchronous calls into batch frames, which the server
+  // runs as separate calls and answers in one batch frame. It trades the
+  // latency of the window for fewer frames, syscalls and wakeups on both
+  // sides, for the bursts of tiny calls. Larger calls are sent alone.
+  // Set it before the first AsyncCall(), Call() and Send() are not batched.
+  inline void set_batching(bool is_batching, const BatchOptions &options = BatchOptions()) {
+    is_batching_ = is_batching;
+    batch_options_ = options;
   }
 
+  // Accept compressed responses, and compress the requests of at least
+  // options.threshold bytes once the server has shown that it accepts
+  // them too, see Compression. It trades cycles for bandwidth, for the
+  // large arrays on the slow links. Set it before the first call.
+  inline void set_compression(bool is_enabled, const CompressionOptions &options = CompressionOptions()) {
+    if (is_enabled)
+      compression_.reset(new Compression(options));
+    else
+      compression_.reset();
+  }
+  // The compression ratio and the cycles spent on it on this connection.
+  inline CompressionStats compression_stats() const {
+    return compression_ == nullptr ? CompressionStats() : compression_->stats();
+  }
+
+  // The number of read and write operations on the transport issued by
+  // the asynchronous calls, each of them is at least one syscall. Read
+  // them while the io_context is not running.
+  inline uint64_t num_reads() const { return num_reads_; }
+  inline uint64_t num_writes() const { return num_writes_; }
+
+  // Names are only hashed on the client side, the wire carries the id.
+  template <typename RespT, typename... Args>
+  inline Response<RespT> Call(const std::string &func_name, Args&... args) {
+    return Call<RespT>(MethodId(func_name), args...);
+  }
+
+  template <typename RespT, typename... Args>
+  inline Response<RespT> Call(uint32_t method_id, Args&... args) {
+    return Receive<RespT>(Send(method_id, args...));
+  }
+
+  // Vectorized call: run the method over each set of arguments in a
+  // single request, and the value is the results in the same order. It
+  // saves the round trips and the dispatches of calling them one by one.
+  // The server runs the sets of an EXEC_POOL method in parallel on its
+  // worker pool, eg.
+  //   std::vector<std::tuple<int, int>> args = { {1, 2}, {3, 4} };
+  //   auto ret = client.CallMany<int>("multiply", args); // {2, 12}
   template <typename RespT, typename... Args>
-  Response<RespT> Call(std::string func_name, Args&... args) {
-    // Send.
-    {
-      message_.Pack(func_name, args...);
-      asio::write(socket_, asio::buffer(message_.header(), message_.header_length()));
-      asio::write(socket_, asio::buffer(message_.body(), message_.body_length()));
+  Response<std::vector<RespT>> CallMany(const std::string &func_name,
+                                        const std::vector<std::tuple<Args...>> &args) {
+    uint32_t method_id = MethodId(func_name);
+    InitRequest(&message_, method_id);
+    message_.set_flags(FLAG_MANY);
+    message_.Pack(args);
+    WriteMessage(message_);
+
+    pending_[message_.request_id()] = method_id;
+    return Receive<std::vector<RespT>>(message_.request_id());
+  }
+
+  // Pipelining: Send() writes a request without waiting for its response
+  // and returns its request id, several requests can be sent in a row
+  // before their responses are collected by Receive(). Keep the number
+  // of requests in flight bounded, the server stops reading new requests
+  // if too many of them have not been answered yet.
+  template <typename... Args>
+  inline uint64_t Send(const std::string &func_name, Args&... args) {
+    return Send(MethodId(func_name), args...);
+  }
+
+  template <typename... Args>
+  uint64_t Send(uint32_t method_id, Args&... args) {
+    InitRequest(&message_, method_id);
+    message_.Pack(args...);
+    WriteMessage(message_);
+
+    pending_[message_.request_id()] = method_id;
+    return message_.request_id();
+  }
+
+  // Wait for the response of the given request. Responses of the other
+  // requests that arrive earlier are kept until they are asked for.
+  template <typename RespT>
+  Response<RespT> Receive(uint64_t request_id) {
+    Response<RespT> ret;
+    ret.value = RespT();
+
+    auto pending = pending_.find(request_id);
+    if (pending == pending_.end()) {
+      ret.status = STATUS_BAD_REQUEST;
+      ret.error_str = "Unknown request: " + std::to_string(request_id);
+      return ret;
     }
-    // Receive.
-    {
-      asio::error_code error;
-      // Read header according to the given length.
-      socket_.read_some(asio::buffer(message_.header(), message_.header_length()));
-      // Unpack the header to get the length of body.
-      message_.UnpackHeader();
-      // Given the length of body, read body.
-      socket_.read_some(asio::buffer(message_.body(), message_.body_length()));
-      // Unpack Body.
-      Response<RespT> ret;
-      std::string ret_func_name;
-      message_.GetFuncName(ret_func_name);
-      if (ret_func_name != func_name) {
-        ret.error_str = "Received message: " + ret_func_name;
-        ret.value = 0;
+    uint32_t method_id = pending->second;
+    pending_.erase(pending);
+
+    RpcMessage *message = nullptr;
+    auto arrived = arrived_.find(request_id);
+    if (arrived != arrived_.end()) {
+      message = arrived->second;
+      arrived_.erase(arrived);
+    }
+    while (message == nullptr) {
+      RpcMessage *received = ReadFrame();
+      if (received == nullptr) {
+        ret.status = STATUS_BAD_REQUEST;
+        ret.error_str = "Invalid frame header.";
+        return ret;
+      }
+      if (received->request_id() == request_id)
+        message = received;
+      else
+        arrived_[received->request_id()] = received;
+    }
+
+    UnpackResponse(*message, method_id, ret);
+    ReleaseMessage(message);
+    return ret;
+  }
+
+  // Streaming calls. A side only sends as many chunks as the other side
+  // has granted credits for, so neither of them has to hold the whole 
+  // stream. They are synchronous like Call(), not for AsyncCall().
+  // The window is the number of chunks the server may send ahead.
+  inline void set_stream_window(uint32_t window) { stream_window_ = std::max(window, 1u); }
+
+  // Server-streaming: on_chunk is called for each chunk in order,
+  // and the value of the response is the number of chunks.
+  template <typename Chunk, typename... Args>
+  Response<uint64_t> CallServerStream(const std::string &func_name,
+    std::function<void(Chunk&)> on_chunk, Args&... args) {
+    uint32_t method_id = MethodId(func_name);
+    InitRequest(&message_, method_id);
+    message_.set_flags(FLAG_STREAM);
+    message_.Pack(args...);
+    uint64_t request_id = message_.request_id();
+    WriteMessage(message_);
+    SendCredit(request_id, method_id, stream_window_);
+
+    Response<uint64_t> ret;
+    ret.value = 0;
+    uint32_t consumed = 0;
+    while (true) {
+      RpcMessage *message = ReadFrame(request_id);
+      if (message == nullptr) {
+        ret.status = STATUS_BAD_REQUEST;
+        ret.error_str = "Invalid frame header.";
+        return ret;
+      }
+      // Not a chunk, it has failed.
+      if (!(message->flags() & FLAG_STREAM)) {
+        uint64_t count = ret.value;
+        UnpackResponse(*message, method_id, ret);
+        ret.value = count;
+        ReleaseMessage(message);
+        return ret;
       }
-      else {
+      if (message->flags() & FLAG_END) {
+        ReleaseMessage(message);
+        ret.status = STATUS_OK;
         ret.error_str = "Success.";
-        message_.GetArgs(ret.value);
+        return ret;
+      }
+
+      Chunk chunk;
+      message->GetArgs(chunk);
+      if (!message->buffer().good()) {
+        ReleaseMessage(message);
+        ret.status = STATUS_BAD_REQUEST;
+        ret.error_str = "Failed to unpack a chunk of the stream.";
+        return ret;
+      }
+      // Before releasing the message, the chunk may be a view of it.
+      on_chunk(chunk);
+      ReleaseMessage(message);
+      ret.value++;
+
+      if (++consumed >= std::max(stream_window_ / 2, 1u)) {
+        SendCredit(request_id, method_id, consumed);
+        consumed = 0;
+      }
+    }
+  }
+
+  // Client-streaming: producer is called for each chunk until it returns
+  // false, and then the response is computed by the server from them.
+  template <typename RespT, typename Chunk, typename... Args>
+  Response<RespT> CallClientStream(const std::string &func_name,
+    std::function<bool(Chunk&)> producer, Args&... args) {
+    uint32_t method_id = MethodId(func_name);
+    InitRequest(&message_, method_id);
+    message_.set_flags(FLAG_STREAM);
+    message_.Pack(args...);
+    uint64_t request_id = message_.request_id();
+    WriteMessage(message_);
+
+    Response<RespT> ret;
+    ret.value = RespT();
+    uint32_t credits = 0;
+    Chunk chunk;
+    while (true) {
+      // Produce the next chunk only when it can be sent.
+      while (credits == 0) {
+        RpcMessage *message = ReadFrame(request_id);
+        if (message == nullptr) {
+          ret.status = STATUS_BAD_REQUEST;
+          ret.error_str = "Invalid frame header.";
+          return ret;
+        }
+        if (!(message->flags() & FLAG_CREDIT)) {
+          // Answered before the end, it has failed.
+          UnpackResponse(*message, method_id, ret);
+          ReleaseMessage(message);
+          return ret;
+        }
+        uint32_t granted = 0;
+        message->GetArgs(granted);
+        credits += granted;
+        ReleaseMessage(message);
+      }
+      if (!producer(chunk))
+        break;
+
+      message_.set_flags(FLAG_STREAM);
+      message_.Pack(chunk);
+      WriteMessage(message_);
+      credits--;
+    }
+    message_.set_flags(FLAG_STREAM | FLAG_END);
+    message_.Pack();
+    WriteMessage(message_);
+
+    // Skip the credits that are still on the way.
+    while (true) {
+      RpcMessage *message = ReadFrame(request_id);
+      if (message == nullptr) {
+        ret.status = STATUS_BAD_REQUEST;
+        ret.error_str = "Invalid frame header.";
+        return ret;
+      }
+      if (message->flags() & FLAG_CREDIT) {
+        ReleaseMessage(message);
+        continue;
       }
+      UnpackResponse(*message, method_id, ret);
+      ReleaseMessage(message);
       return ret;
     }
   }
 
+  // Asynchronous call. The completion token receives a Response<RespT>,
+  // it can be a callback, asio::use_future to get a 
+  // std::future<Response<RespT>>, or any other asio completion token.
+  // The io_context of this client has to be run by a thread, and that
+  // single thread can drive the calls of many clients at the same time.
+  // It can be called from any thread, but do not mix it with 
+  // Send/Receive on the same client.
+  template <typename RespT, typename CompletionToken, typename... Args>
+  inline auto AsyncCall(const std::string &func_name, CompletionToken &&token, Args&... args) {
+    return AsyncCall<RespT>(MethodId(func_name), std::forward<CompletionToken>(token), args...);
+  }
+
+  template <typename RespT, typename CompletionToken, typename... Args>
+  auto AsyncCall(uint32_t method_id, CompletionToken &&token, Args&... args) {
+    // Pack it here, the arguments may be gone before the initiation runs.
+    RpcMessage *message = AcquireMessage();
+    InitRequest(message, method_id);
+    message->Pack(args...);
+
+    return asio::async_initiate<CompletionToken, void(Response<RespT>)>(
+      [this, method_id, message](auto handler) {
+      typedef DerivedPendingCall<RespT, decltype(handler)> CallType;
+      std::unique_ptr<PendingCall> call(
+        new CallType(method_id, std::move(handler), io_context_.get_executor()));
+      asio::post(io_context_, 
+        [this, message, call = std::move(call)]() mutable {
+        StartCall(message, std::move(call));
+      });
+    }, token);
+  }
+
+#if defined(ASIO_HAS_CO_AWAIT)
+  // In a C++20 coroutine: auto ret = co_await client.CoCall<int>("add", a, b);
+  // The coroutine is suspended until the response arrives and resumed on
+  // its own executor, which may run on the same thread as the io_context
+  // of this client. A coroutine handler of a server can make nested calls
+  // this way without blocking its thread, see Processor::Bind().
+  template <typename RespT, typename... Args>
+  inline asio::awaitable<Response<RespT>> CoCall(const std::string &func_name, Args&... args) {
+    return AsyncCall<RespT>(MethodId(func_name), asio::use_awaitable, args...);
+  }
+#endif
+
 private:
-  asio::ip::tcp::socket socket_;
+  inline void InitRequest(RpcMessage *message, uint32_t method_id) {
+    message->set_request_id(++request_id_);
+    message->set_method_id(method_id);
+    message->set_status(STATUS_OK);
+    message->set_flags(0);
+    message->set_compact(is_compact_);
+    message->set_timeout_us((uint32_t)std::min<int64_t>(timeout_.count(), UINT32_MAX));
+  }
+
+  template <typename RespT>
+  static void UnpackResponse(RpcMessage &message, uint32_t method_id, Response<RespT> &ret) {
+    ret.status = message.status();
+    if (ret.status != STATUS_OK) {
+      ret.value = RespT();
+      message.GetArgs(ret.error_str);
+    }
+    else if (message.method_id() != method_id) {
+      ret.status = STATUS_BAD_REQUEST;
+      ret.value = RespT();
+      ret.error_str = "Received message: " + std::to_string(message.method_id());
+    }
+    else {
+      ret.error_str = "Success.";
+      message.GetArgs(ret.value);
+    }
+  }
+
+  // Read one frame. Small frames are read in batches through inbound_,
+  // the rest of a large body is read into the message directly.
+  RpcMessage *ReadFrame();
+  // Read frames until one of the given request, the others are kept
+  // in arrived_ for Receive().
+  RpcMessage *ReadFrame(uint64_t request_id);
+  void WriteMessage(RpcMessage &message);
+  // Mark a request as accepting compression, and compress it if the
+  // server accepts it too.
+  void Deflate(RpcMessage *message);
+  // Note whether the server accepts compression, and restore a
+  // compressed body. Returns false if it can not be restored.
+  bool Inflate(RpcMessage *message);
+  void SendCredit(uint64_t request_id, uint32_t method_id, uint32_t credits);
+
+  // The asynchronous path, all of them run on the io_context.
+  void StartCall(RpcMessage *message, std::unique_ptr<PendingCall> call);
+  void do_write();
+  void do_read();
+  void do_parse();
+  void do_read_body(RpcMessage *message);
+  void Complete(RpcMessage *message);
+  void CompleteBatch(RpcMessage *message);
+  void AddToBatch(RpcMessage *message);
+  void FlushBatch();
+  // Fail the asynchronous calls whose deadlines have passed.
+  void ArmDeadlineTimer();
+  void ExpireCalls();
+  // Fail all the calls in flight after an I/O error.
+  void Abort();
+
+  RpcMessage *AcquireMessage();
+  void ReleaseMessage(RpcMessage *message);
+
+private:
+  asio::io_context &io_context_;
   asio::ip::tcp::resolver resolver_; 
-  
+  std::unique_ptr<Transport> transport_;
+
+  std::atomic<uint64_t> request_id_;
+  bool is_compact_;
+  uint32_t stream_window_;
+  std::chrono::microseconds timeout_;
   RpcMessage message_;
+  std::vector<asio::const_buffer> sync_buffers_;
+  Buffer inbound_;
+
+  // Requests in flight: request id -> method id.
+  std::unordered_map<uint64_t, uint32_t> pending_;
+  // Responses that arrived before they were asked for.
+  std::unordered_map<uint64_t, RpcMessage *> arrived_;
+
+  // Asynchronous calls in flight.
+  std::unordered_map<uint64_t, std::unique_ptr<PendingCall>> pending_calls_;
+  std::deque<RpcMessage *> write_queue_;
+  std::vector<RpcMessage *> writing_;
+  std::vector<asio::const_buffer> write_buffers_;
+  bool is_reading_;
+
+  // The batch being filled, see set_batching().
+  bool is_batching_;
+  BatchOptions batch_options_;
+  RpcMessage *batch_;
+  size_t batch_calls_;
+  asio::steady_timer batch_timer_;
+
+  // Deadlines of the asynchronous calls with a timeout, the entries of
+  // the calls that have completed are skipped when they are reached.
+  std::multimap<std::chrono::steady_clock::time_point, uint64_t> deadlines_;
+  asio::steady_timer deadline_timer_;
+  bool is_deadline_armed_;
+  std::chrono::steady_clock::time_point deadline_expiry_;
+
+  // See set_compression().
+  std::unique_ptr<Compression> compression_;
+  bool peer_accepts_compression_;
+  Buffer compress_buffer_;
+
+  uint64_t num_reads_;
+  uint64_t num_writes_;
+
+  // Messages may be acquired by AsyncCall() on any thread.
+  std::mutex pool_mutex_;
+  std::vector<std::unique_ptr<RpcMessage>> messages_;
+  std::vector<RpcMessage *> free_messages_;
 };
 
 } // namespace mrpc
 
-#endif // MRPC_CLIENT_H_
\ No newline at end of file
+#endif // MRPC_CLIENT_H_
@@ -0,0 +1,281 @@
+#include "client_pool.h"
+
+#include <algorithm>
+
+namespace mrpc {
+
+bool Endpoint::Parse(const std::string &address, Endpoint *endpoint) {
+  if (address.compare(0, 5, "unix:") == 0) {
+    endpoint->type = LOCAL;
+    endpoint->service = address.substr(5);
+  }
+  else if (address.compare(0, 4, "shm:") == 0) {
+    endpoint->type = SHM;
+    endpoint->service = address.substr(4);
+  }
+  else {
+    size_t pos = address.rfind(':');
+    if (pos == std::string::npos || pos == 0)
+      return false;
+    endpoint->type = TCP;
+    endpoint->host = address.substr(0, pos);
+    endpoint->service = address.substr(pos + 1);
+  }
+  return !endpoint->service.empty();
+}
+
+ClientPool::ClientPool(const std::vector<std::string> &addresses,
+                       const ClientPoolOptions &options)
+  : options_(options), is_stopping_(false) {
+  int num_threads = std::max(1, options_.num_threads);
+  for (int i = 0; i < num_threads; i++) {
+    io_contexts_.emplace_back(new asio::io_context(1));
+    works_.push_back(asio::make_work_guard(*io_contexts_[i]));
+  }
+
+  for (const std::string &address : addresses) {
+    Endpoint endpoint;
+    if (!Endpoint::Parse(address, &endpoint))
+      continue;
+    endpoints_.emplace_back(new EndpointState);
+    endpoints_.back()->endpoint = endpoint;
+  }
+  // Interleave the endpoints, so that the ties in Pick() are spread.
+  for (int n = 0; n < options_.connections_per_endpoint; n++) {
+    for (size_t e = 0; e < endpoints_.size(); e++) {
+      connections_.emplace_back(new Connection);
+      Connection *connection = connections_.back().get();
+      connection->endpoint = e;
+      connection->io_context = io_contexts_[connections_.size() % num_threads].get();
+    }
+  }
+
+  for (auto &io_context : io_contexts_) {
+    asio::io_context *context = io_context.get();
+    threads_.emplace_back([context]() { context->run(); });
+  }
+
+  // Connect before returning, so that the first calls have somewhere to go.
+  // The connections are set up in parallel, and each one gives up after
+  // connect_timeout, so it takes about that long at most.
+  for (auto &connection : connections_)
+    Reconnect(connection.get());
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    connect_cond_.wait(lock, [this]() {
+      for (auto &connection : connections_) {
+        if (connection->is_connecting)
+          return false;
+      }
+      return true;
+    });
+  }
+  checker_ = std::thread([this]() { Check(); });
+}
+
+ClientPool::~ClientPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  cond_.notify_all();
+  checker_.join();
+
+  // Fail the calls in flight, and let the threads return once all
+  // the handlers have run.
+  for (auto &connection : connections_) {
+    std::shared_ptr<Client> client = std::atomic_load(&connection->client);
+    std::atomic_store(&connection->client, std::shared_ptr<Client>());
+    if (client != nullptr)
+      Retire(connection->io_context, client);
+  }
+  works_.clear();
+  for (auto &thread : threads_)
+    thread.join();
+  connections_.clear();
+}
+
+ClientPool::Connection *ClientPool::Pick() {
+  Connection *best = nullptr;
+  Connection *fallback = nullptr;
+  int min_outstanding = INT32_MAX;
+  int min_fallback = INT32_MAX;
+  for (auto &connection : connections_) {
+    if (std::atomic_load(&connection->client) == nullptr)
+      continue;
+    int outstanding = connection->outstanding.load(std::memory_order_relaxed);
+    if (endpoints_[connection->endpoint]->is_ejected.load(std::memory_order_relaxed)) {
+      // Only if all the others are gone.
+      if (outstanding < min_fallback) {
+        min_fallback = outstanding;
+        fallback = connection.get();
+      }
+      continue;
+    }
+    if (outstanding < min_outstanding) {
+      min_outstanding = outstanding;
+      best = connection.get();
+    }
+  }
+  return best != nullptr ? best : fallback;
+}
+
+void ClientPool::OnComplete(Connection *connection, const std::shared_ptr<Client> &client,
+                            StatusCode status, Clock::duration latency) {
+  if (status == STATUS_IO_ERROR) {
+    Disconnect(connection, client);
+    return;
+  }
+  // Exponential moving average with a weight of 1/8.
+  std::atomic<uint64_t> &average = endpoints_[connection->endpoint]->latency;
+  uint64_t sample = std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+  uint64_t old = average.load(std::memory_order_relaxed);
+  average.store(old == 0 ? sample : old - old / 8 + sample / 8, std::memory_order_relaxed);
+}
+
+void ClientPool::Disconnect(Connection *connection, const std::shared_ptr<Client> &client) {
+  std::shared_ptr<Client> expected = client;
+  if (!std::atomic_compare_exchange_strong(&connection->client, &expected, std::shared_ptr<Client>()))
+    return;
+
+  Retire(connection->io_context, client);
+}
+
+void ClientPool::Retire(asio::io_context *io_context, const std::shared_ptr<Client> &client) {
+  // Close it out of the call stack of the client, and keep it alive
+  // until the handlers of the calls it fails have run.
+  asio::post(*io_context, [client, io_context]() {
+    client->Close();
+    asio::post(*io_context, [client]() {});
+  });
+}
+
+void ClientPool::Reconnect(Connection *connection) {
+  bool expected = false;
+  if (!connection->is_connecting.compare_exchange_strong(expected, true))
+    return;
+
+  Endpoint endpoint = endpoints_[connection->endpoint]->endpoint;
+  std::shared_ptr<Client> client(new Client(*connection->io_context));
+  client->set_timeout(options_.timeout);
+  asio::post(*connection->io_context, [this, connection, client, endpoint]() {
+    if (endpoint.type == Endpoint::TCP) {
+      client->AsyncConnect(endpoint.host, endpoint.service, options_.connect_timeout,
+        [this, connection, client](std::error_code ec) {
+        OnConnected(connection, client, !ec);
+      });
+      return;
+    }
+    // The local ones connect or fail at once, there is no remote host to wait for.
+    bool is_connected = false;
+    try {
+      switch (endpoint.type) {
+#ifndef _WIN32
+      case Endpoint::LOCAL:
+        client->ConnectLocal(endpoint.service);
+        is_connected = true;
+        break;
+#endif
+#ifdef __linux__
+      case Endpoint::SHM:
+        client->ConnectShm(endpoint.service);
+        is_connected = true;
+        break;
+#endif
+      default:
+        break;
+      }
+    }
+    catch (std::exception &) {
+      // Try again on the next check.
+    }
+    OnConnected(connection, client, is_connected);
+  });
+}
+
+void ClientPool::OnConnected(Connection *connection, const std::shared_ptr<Client> &client,
+                             bool is_connected) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // The destructor retires the clients once is_stopping_ is set,
+    // so the later ones are not published.
+    if (is_connected && !is_stopping_)
+      std::atomic_store(&connection->client, client);
+    connection->is_connecting = false;
+  }
+  connect_cond_.notify_all();
+}
+
+void ClientPool::Check() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!is_stopping_) {
+    cond_.wait_for(lock, options_.check_interval);
+    if (is_stopping_)
+      break;
+
+    lock.unlock();
+    for (auto &connection : connections_) {
+      if (std::atomic_load(&connection->client) == nullptr)
+        Reconnect(connection.get());
+    }
+    UpdateEjection();
+    lock.lock();
+  }
+}
+
+void ClientPool::UpdateEjection() {
+  Clock::time_point now = Clock::now();
+  std::vector<uint64_t> latencies;
+  int num_ejected = 0;
+  for (auto &endpoint : endpoints_) {
+    if (endpoint->is_ejected && now >= endpoint->ejected_until) {
+      // Give it another chance, with a fresh average.
+      endpoint->latency = 0;
+      endpoint->is_ejected = false;
+    }
+    if (endpoint->is_ejected)
+      num_ejected++;
+    else if (endpoint->latency > 0)
+      latencies.push_back(endpoint->latency);
+  }
+  if (latencies.size() < 2)
+    return;
+
+  std::nth_element(latencies.begin(), latencies.begin() + latencies.size() / 2, latencies.end());
+  double median = latencies[latencies.size() / 2];
+  double threshold = std::max(median * options_.eject_factor,
+    (double)std::chrono::duration_cast<std::chrono::nanoseconds>(options_.eject_min_latency).count());
+  int max_ejected = (int)(endpoints_.size() * options_.max_ejected_fraction);
+
+  for (auto &endpoint : endpoints_) {
+    if (num_ejected >= max_ejected)
+      break;
+    if (!endpoint->is_ejected && endpoint->latency > threshold) {
+      endpoint->ejected_until = now + options_.eject_duration;
+      endpoint->is_ejected = true;
+      num_ejected++;
+    }
+  }
+}
+
+std::vector<ClientPool::EndpointStatus> ClientPool::Status() {
+  std::vector<EndpointStatus> status(endpoints_.size());
+  for (size_t e = 0; e < endpoints_.size(); e++) {
+    const Endpoint &endpoint = endpoints_[e]->endpoint;
+    status[e].address = endpoint.type == Endpoint::TCP ? endpoint.host + ":" + endpoint.service :
+                        (endpoint.type == Endpoint::LOCAL ? "unix:" : "shm:") + endpoint.service;
+    status[e].num_connected = 0;
+    status[e].outstanding = 0;
+    status[e].latency_us = endpoints_[e]->latency / 1e3;
+    status[e].is_ejected = endpoints_[e]->is_ejected;
+  }
+  for (auto &connection : connections_) {
+    EndpointStatus &s = status[connection->endpoint];
+    if (std::atomic_load(&connection->client) != nullptr)
+      s.num_connected++;
+    s.outstanding += connection->outstanding;
+  }
+  return status;
+}
+
+} // namespace mrpc
@@ -0,0 +1,187 @@
+#ifndef MRPC_CLIENT_POOL_H_
+#define MRPC_CLIENT_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "client.h"
+
+namespace mrpc {
+
+// Where a replica is served, eg. "127.0.0.1:8080", "unix:/tmp/a.sock"
+// or "shm:/tmp/a.shm", see Server::ListenLocal() and ListenShm().
+struct Endpoint {
+  enum Type {
+    TCP = 0,
+    LOCAL,
+    SHM
+  };
+  Type type;
+  std::string host;
+  std::string service; // The port, or the path.
+
+  // Returns false if the address can not be parsed.
+  static bool Parse(const std::string &address, Endpoint *endpoint);
+};
+
+struct ClientPoolOptions {
+  int connections_per_endpoint = 2;
+  // Threads running the connections, each with its own io_context.
+  int num_threads = 1;
+  // How often the broken connections are reconnected, and the latency
+  // of the endpoints is checked.
+  std::chrono::milliseconds check_interval{500};
+  // How long a TCP connection may take to be set up. The connections are
+  // set up in the background, so an endpoint that does not answer only
+  // delays itself.
+  std::chrono::milliseconds connect_timeout{1000};
+  // An endpoint is ejected for eject_duration if its average latency is
+  // eject_factor times the median of all the endpoints, and at least
+  // eject_min_latency. At most max_ejected_fraction of them are ejected.
+  double eject_factor = 3.0;
+  std::chrono::microseconds eject_min_latency{1000};
+  std::chrono::milliseconds eject_duration{5000};
+  double max_ejected_fraction = 0.5;
+  // The timeout of each call, 0 for none, see Client::set_timeout().
+  // Without it, a call to a replica that hangs never completes.
+  std::chrono::microseconds timeout{0};
+};
+
+// Asynchronous clients to the replicas of a service: N connections to
+// each endpoint, and each call goes to the connection with the fewest
+// calls in flight, so a replica that answers slower gets fewer of them.
+// Broken connections are reconnected by a background thread, which also
+// ejects the endpoints much slower than the others for a while.
+// The calls can be made from any thread. A call is not retried on another
+// connection if its connection fails, it completes with STATUS_IO_ERROR.
+class ClientPool {
+  typedef std::chrono::steady_clock Clock;
+
+  struct Connection {
+    int endpoint;
+    asio::io_context *io_context;
+    // nullptr while disconnected, accessed by std::atomic_load/store.
+    std::shared_ptr<Client> client;
+    std::atomic<int> outstanding{0};
+    // Set while a connection is being set up, see Reconnect().
+    std::atomic<bool> is_connecting{false};
+  };
+
+  struct EndpointState {
+    Endpoint endpoint;
+    // Moving average of the latency in ns, updated without a lock as
+    // it only has to be roughly right.
+    std::atomic<uint64_t> latency{0};
+    std::atomic<bool> is_ejected{false};
+    Clock::time_point ejected_until;
+  };
+
+public:
+  // The addresses are parsed by Endpoint::Parse(), the invalid ones are skipped.
+  ClientPool(const std::vector<std::string> &addresses,
+             const ClientPoolOptions &options = ClientPoolOptions());
+  ~ClientPool();
+
+  template <typename RespT, typename... Args>
+  inline Response<RespT> Call(const std::string &func_name, Args&... args) {
+    return AsyncCall<RespT>(MethodId(func_name), asio::use_future, args...).get();
+  }
+
+  // The completion token receives a Response<RespT>, as Client::AsyncCall().
+  template <typename RespT, typename CompletionToken, typename... Args>
+  inline auto AsyncCall(const std::string &func_name, CompletionToken &&token, Args&... args) {
+    return AsyncCall<RespT>(MethodId(func_name), std::forward<CompletionToken>(token), args...);
+  }
+
+  template <typename RespT, typename CompletionToken, typename... Args>
+  auto AsyncCall(uint32_t method_id, CompletionToken &&token, Args&... args) {
+    return asio::async_initiate<CompletionToken, void(Response<RespT>)>(
+      [this, method_id, &args...](auto handler) {
+      Start<RespT>(method_id, std::move(handler), args...);
+    }, token);
+  }
+
+  // For monitoring.
+  struct EndpointStatus {
+    std::string address;
+    int num_connected;
+    int outstanding;
+    double latency_us;
+    bool is_ejected;
+  };
+  std::vector<EndpointStatus> Status();
+
+private:
+  template <typename RespT, typename Handler, typename... Args>
+  void Start(uint32_t method_id, Handler &&handler, Args&... args) {
+    Connection *connection = Pick();
+    std::shared_ptr<Client> client;
+    if (connection != nullptr)
+      client = std::atomic_load(&connection->client);
+    if (client == nullptr) {
+      Response<RespT> ret;
+      ret.status = STATUS_IO_ERROR;
+      ret.value = RespT();
+      ret.error_str = "No connection available.";
+      asio::post(*io_contexts_[0], [handler = std::move(handler), ret = std::move(ret)]() mutable {
+        handler(std::move(ret));
+      });
+      return;
+    }
+
+    connection->outstanding++;
+    Clock::time_point start = Clock::now();
+    client->AsyncCall<RespT>(method_id,
+      [this, connection, client, start, handler = std::move(handler)](Response<RespT> ret) mutable {
+      connection->outstanding--;
+      OnComplete(connection, client, ret.status, Clock::now() - start);
+      handler(std::move(ret));
+      // The client may be running the call stack of this handler,
+      // only let it go afterwards.
+      asio::post(*connection->io_context, [client = std::move(client)]() {});
+    }, args...);
+  }
+
+  // The connection with the fewest calls in flight, preferring the endpoints
+  // that are not ejected. Returns nullptr if none is connected.
+  Connection *Pick();
+  void OnComplete(Connection *connection, const std::shared_ptr<Client> &client,
+                  StatusCode status, Clock::duration latency);
+  // Drop a broken client, unless it has been replaced already.
+  void Disconnect(Connection *connection, const std::shared_ptr<Client> &client);
+  static void Retire(asio::io_context *io_context, const std::shared_ptr<Client> &client);
+
+  // The background thread.
+  void Check();
+  // Start to set up a new client on the thread of the connection,
+  // unless it is being set up already.
+  void Reconnect(Connection *connection);
+  void OnConnected(Connection *connection, const std::shared_ptr<Client> &client, bool is_connected);
+  void UpdateEjection();
+
+private:
+  ClientPoolOptions options_;
+  std::vector<std::unique_ptr<EndpointState>> endpoints_;
+  std::vector<std::unique_ptr<Connection>> connections_;
+
+  std::vector<std::unique_ptr<asio::io_context>> io_contexts_;
+  std::vector<asio::executor_work_guard<asio::io_context::executor_type>> works_;
+  std::vector<std::thread> threads_;
+
+  std::thread checker_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  // Signaled when a connection has been set up or has failed.
+  std::condition_variable connect_cond_;
+  bool is_stopping_;
+};
+
+} // namespace mrpc
+
+#endif // MRPC_CLIENT_POOL_H_
@@ -0,0 +1,280 @@
+#include "compression.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef MRPC_USE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace mrpc {
+
+///////////////
+// LZ codec
+///////////////
+// A sequence is a token, the literals and a match. The high 4 bits of
+// the token are the number of literals and the low 4 bits the length of
+// the match minus LZ_MIN_MATCH, 15 of either is followed by bytes of 255
+// and a last byte smaller than it to be added. The match is a 16-bit
+// offset back into the output. The last sequence only has literals.
+// As LZ4 requires, the last match starts at least LZ_MF_LIMIT bytes before
+// the end and leaves at least LZ_LAST_LITERALS bytes for the last sequence.
+const static size_t LZ_MIN_MATCH = 4;
+const static size_t LZ_MF_LIMIT = 12;
+const static size_t LZ_LAST_LITERALS = 5;
+const static size_t LZ_MAX_OFFSET = 65535;
+const static int LZ_HASH_BITS = 12;
+
+static inline uint32_t LzRead32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint32_t LzHash(uint32_t seq) {
+  return (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint8_t *LzWriteLength(uint8_t *p, size_t n) {
+  while (n >= 255) {
+    *p++ = 255;
+    n -= 255;
+  }
+  *p++ = (uint8_t)n;
+  return p;
+}
+
+static inline bool LzReadLength(const uint8_t **ip, const uint8_t *end, size_t *n) {
+  uint8_t b;
+  do {
+    if (*ip >= end)
+      return false;
+    b = *(*ip)++;
+    *n += b;
+  } while (b == 255);
+  return true;
+}
+
+// match_length is 0 for the last sequence.
+static bool LzEmit(uint8_t **op, uint8_t *end, const char *literals,
+                   size_t literal_length, size_t offset, size_t match_length) {
+  size_t extra = match_length == 0 ? 0 : match_length - LZ_MIN_MATCH;
+  size_t need = 1 + literal_length / 255 + 1 + literal_length + 2 + extra / 255 + 1;
+  if ((size_t)(end - *op) < need)
+    return false;
+
+  uint8_t *p = *op;
+  uint8_t *token = p++;
+  *token = (uint8_t)((std::min<size_t>(literal_length, 15) << 4) | std::min<size_t>(extra, 15));
+  if (literal_length >= 15)
+    p = LzWriteLength(p, literal_length - 15);
+  memcpy(p, literals, literal_length);
+  p += literal_length;
+  if (match_length > 0) {
+    p[0] = (uint8_t)offset;
+    p[1] = (uint8_t)(offset >> 8);
+    p += 2;
+    if (extra >= 15)
+      p = LzWriteLength(p, extra - 15);
+  }
+  *op = p;
+  return true;
+}
+
+// Greedy matching with a hash table of the last position of each 4-byte
+// sequence. Returns 0 if the output does not fit in capacity.
+static size_t LzCompress(const char *src, size_t length, char *dst, size_t capacity) {
+  // The positions are kept across the calls, they are checked before use.
+  thread_local uint32_t table[1 << LZ_HASH_BITS] = {};
+  if (length > UINT32_MAX)
+    return 0;
+
+  uint8_t *op = (uint8_t *)dst;
+  uint8_t *end = op + capacity;
+  size_t anchor = 0, pos = 0;
+  size_t limit = length > LZ_MF_LIMIT ? length - LZ_MF_LIMIT : 0;
+  size_t match_end = length > LZ_LAST_LITERALS ? length - LZ_LAST_LITERALS : 0;
+  // The step grows by one every 64 misses in a row, to get over the
+  // data without matches quickly.
+  size_t misses = 0;
+  while (pos < limit) {
+    uint32_t seq = LzRead32(src + pos);
+    uint32_t &slot = table[LzHash(seq)];
+    size_t candidate = slot;
+    slot = (uint32_t)pos;
+    if (candidate >= pos || pos - candidate > LZ_MAX_OFFSET || LzRead32(src + candidate) != seq) {
+      pos += 1 + (misses++ >> 6);
+      continue;
+    }
+    misses = 0;
+    size_t match_length = LZ_MIN_MATCH;
+    while (pos + match_length < match_end && src[candidate + match_length] == src[pos + match_length])
+      match_length++;
+    if (!LzEmit(&op, end, src + anchor, pos - anchor, pos - candidate, match_length))
+      return 0;
+    pos += match_length;
+    anchor = pos;
+  }
+  if (!LzEmit(&op, end, src + anchor, length - anchor, 0, 0))
+    return 0;
+  return op - (uint8_t *)dst;
+}
+
+// Returns false unless the input decodes to exactly length bytes.
+static bool LzDecompress(const char *src, size_t src_length, char *dst, size_t length) {
+  const uint8_t *ip = (const uint8_t *)src;
+  const uint8_t *ip_end = ip + src_length;
+  uint8_t *op = (uint8_t *)dst;
+  uint8_t *op_end = op + length;
+  while (ip < ip_end) {
+    uint8_t token = *ip++;
+    size_t literal_length = token >> 4;
+    if (literal_length == 15 && !LzReadLength(&ip, ip_end, &literal_length))
+      return false;
+    if (literal_length > (size_t)(ip_end - ip) || literal_length > (size_t)(op_end - op))
+      return false;
+    // Most runs are short, copy a fixed 16 bytes if there is room.
+    if (literal_length <= 16 && ip_end - ip >= 16 && op_end - op >= 16)
+      memcpy(op, ip, 16);
+    else
+      memcpy(op, ip, literal_length);
+    op += literal_length;
+    ip += literal_length;
+    if (ip == ip_end)
+      break;
+
+    if (ip_end - ip < 2)
+      return false;
+    size_t offset = ip[0] | ((size_t)ip[1] << 8);
+    ip += 2;
+    size_t match_length = token & 15;
+    if (match_length == 15 && !LzReadLength(&ip, ip_end, &match_length))
+      return false;
+    match_length += LZ_MIN_MATCH;
+    if (offset == 0 || offset > (size_t)(op - (uint8_t *)dst) || match_length > (size_t)(op_end - op))
+      return false;
+    const uint8_t *match = op - offset;
+    if (offset >= 8 && (size_t)(op_end - op) >= match_length + 8) {
+      // 8 bytes at a time, which may run past the end of the match.
+      for (size_t i = 0; i < match_length; i += 8)
+        memcpy(op + i, match + i, 8);
+    }
+    else {
+      // Near the end, or overlapped so that it repeats the last offset bytes.
+      for (size_t i = 0; i < match_length; i++)
+        op[i] = match[i];
+    }
+    op += match_length;
+  }
+  return op == op_end;
+}
+
+///////////////
+// Compression
+///////////////
+bool Compression::IsSupported(int codec) {
+#ifdef MRPC_USE_ZLIB
+  if (codec == CODEC_ZLIB)
+    return true;
+#endif
+  return codec == CODEC_LZ;
+}
+
+bool Compression::Compress(RpcMessage *message, Buffer *scratch) {
+  size_t length = message->body_length();
+  if (length < options_.threshold || length <= PREFIX_SIZE ||
+      (message->flags() & FLAG_COMPRESSED) || !IsSupported(options_.codec))
+    return false;
+
+  auto start = Clock::now();
+  uint8_t codec = (uint8_t)options_.codec;
+  uint64_t raw_length = length;
+  scratch->Clear();
+  scratch->Write(&codec, sizeof(codec));
+  scratch->Write(&raw_length, sizeof(raw_length));
+  // It has to be smaller than the raw body to be sent.
+  size_t capacity = length - PREFIX_SIZE - 1;
+  scratch->Reserve(capacity);
+
+  size_t compressed = 0;
+  if (codec == CODEC_LZ) {
+    compressed = LzCompress(message->body(), length, scratch->tail(), capacity);
+  }
+#ifdef MRPC_USE_ZLIB
+  else if (codec == CODEC_ZLIB) {
+    uLongf dst_length = capacity;
+    if (compress2((Bytef *)scratch->tail(), &dst_length, (const Bytef *)message->body(),
+                  length, options_.level) == Z_OK)
+      compressed = dst_length;
+  }
+#endif
+  uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  compress_ns_.fetch_add(elapsed, std::memory_order_relaxed);
+  if (compressed == 0) {
+    frames_incompressible_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  scratch->Commit(compressed);
+  message->SwapBody(*scratch);
+  message->set_flags(message->flags() | FLAG_COMPRESSED);
+
+  frames_compressed_.fetch_add(1, std::memory_order_relaxed);
+  raw_bytes_.fetch_add(length, std::memory_order_relaxed);
+  compressed_bytes_.fetch_add(message->body_length(), std::memory_order_relaxed);
+  return true;
+}
+
+bool Compression::Decompress(RpcMessage *message, Buffer *scratch, uint64_t max_length) {
+  size_t length = message->body_length();
+  if (length < PREFIX_SIZE)
+    return false;
+  uint8_t codec;
+  uint64_t raw_length;
+  memcpy(&codec, message->body(), sizeof(codec));
+  memcpy(&raw_length, message->body() + sizeof(codec), sizeof(raw_length));
+  if (!IsSupported(codec) || raw_length > std::min(max_length, RpcMessage::MAX_BODY_LENGTH))
+    return false;
+
+  auto start = Clock::now();
+  const char *src = message->body() + PREFIX_SIZE;
+  size_t src_length = length - PREFIX_SIZE;
+  scratch->Resize(raw_length);
+  bool is_ok = false;
+  if (codec == CODEC_LZ) {
+    is_ok = LzDecompress(src, src_length, scratch->data(), raw_length);
+  }
+#ifdef MRPC_USE_ZLIB
+  else if (codec == CODEC_ZLIB) {
+    uLongf dst_length = raw_length;
+    is_ok = uncompress((Bytef *)scratch->data(), &dst_length, (const Bytef *)src, src_length) == Z_OK
+            && dst_length == raw_length;
+  }
+#endif
+  if (!is_ok)
+    return false;
+
+  message->SwapBody(*scratch);
+  message->set_flags(message->flags() & ~FLAG_COMPRESSED);
+
+  uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+  frames_decompressed_.fetch_add(1, std::memory_order_relaxed);
+  decompressed_bytes_.fetch_add(raw_length, std::memory_order_relaxed);
+  decompress_ns_.fetch_add(elapsed, std::memory_order_relaxed);
+  return true;
+}
+
+CompressionStats Compression::stats() const {
+  CompressionStats stats;
+  stats.frames_compressed = frames_compressed_.load(std::memory_order_relaxed);
+  stats.raw_bytes = raw_bytes_.load(std::memory_order_relaxed);
+  stats.compressed_bytes = compressed_bytes_.load(std::memory_order_relaxed);
+  stats.frames_incompressible = frames_incompressible_.load(std::memory_order_relaxed);
+  stats.compress_ns = compress_ns_.load(std::memory_order_relaxed);
+  stats.frames_decompressed = frames_decompressed_.load(std::memory_order_relaxed);
+  stats.decompressed_bytes = decompressed_bytes_.load(std::memory_order_relaxed);
+  stats.decompress_ns = decompress_ns_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+} // namespace mrpc
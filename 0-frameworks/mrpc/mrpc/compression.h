@@ -0,0 +1,99 @@
+#ifndef MRPC_COMPRESSION_H_
+#define MRPC_COMPRESSION_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "buffer.h"
+#include "message.h"
+
+namespace mrpc {
+
+enum CompressionCodec {
+  // The built-in LZ77 codec in the format of LZ4 blocks, always available.
+  // Fast on both sides, for the links where the cycles matter.
+  CODEC_LZ = 1,
+  // deflate, smaller output for more cycles. Only if built with
+  // MRPC_USE_ZLIB, and the peer has to be built with it as well.
+  CODEC_ZLIB = 2
+};
+
+struct CompressionOptions {
+  CompressionCodec codec = CODEC_LZ;
+  // Frames with a smaller body are sent as they are, the small ones
+  // do not gain enough to pay for the cycles.
+  size_t threshold = 4096;
+  // For CODEC_ZLIB, 1 (fastest) to 9 (smallest).
+  int level = 1;
+};
+
+// A snapshot of the counters of a Compression.
+struct CompressionStats {
+  // Frames sent compressed, and their bodies before and after.
+  uint64_t frames_compressed = 0;
+  uint64_t raw_bytes = 0;
+  uint64_t compressed_bytes = 0;
+  // Frames over the threshold that were sent as they are, as they did
+  // not get smaller.
+  uint64_t frames_incompressible = 0;
+  uint64_t compress_ns = 0;
+  // Compressed frames received.
+  uint64_t frames_decompressed = 0;
+  uint64_t decompressed_bytes = 0;
+  uint64_t decompress_ns = 0;
+
+  // Compressed size / raw size of the frames sent compressed.
+  inline double ratio() const {
+    return raw_bytes == 0 ? 1.0 : (double)compressed_bytes / raw_bytes;
+  }
+};
+
+// Per-frame compression of the message bodies. A compressed body starts
+// with the codec (uint8_t) and the raw length (uint64_t), and the header
+// is marked with FLAG_COMPRESSED. It is negotiated on each connection: a
+// client with compression marks its requests with FLAG_ACCEPT_COMPRESSION,
+// a server with compression then compresses the responses on that
+// connection and marks them with the same flag, and the client compresses
+// its requests once it has seen the flag. Either side without it keeps
+// sending raw frames. The counters are shared by the threads of a server.
+class Compression {
+  typedef std::chrono::steady_clock Clock;
+
+public:
+  // The codec and the raw length in front of a compressed body.
+  const static size_t PREFIX_SIZE = 1 + sizeof(uint64_t);
+
+  Compression(const CompressionOptions &options) : options_(options) {}
+
+  static bool IsSupported(int codec);
+  inline const CompressionOptions &options() const { return options_; }
+
+  // Compress the body of a packed message in place, if it is at least
+  // threshold bytes and gets smaller. scratch is only for its storage,
+  // it is swapped with the body. Returns true if it has been compressed.
+  bool Compress(RpcMessage *message, Buffer *scratch);
+  // Restore the body of a message with FLAG_COMPRESSED. Returns false if
+  // the body is corrupted, its codec is not supported, or it would be
+  // longer than max_length.
+  bool Decompress(RpcMessage *message, Buffer *scratch,
+                  uint64_t max_length = RpcMessage::MAX_BODY_LENGTH);
+
+  CompressionStats stats() const;
+
+private:
+  CompressionOptions options_;
+
+  std::atomic<uint64_t> frames_compressed_{0};
+  std::atomic<uint64_t> raw_bytes_{0};
+  std::atomic<uint64_t> compressed_bytes_{0};
+  std::atomic<uint64_t> frames_incompressible_{0};
+  std::atomic<uint64_t> compress_ns_{0};
+  std::atomic<uint64_t> frames_decompressed_{0};
+  std::atomic<uint64_t> decompressed_bytes_{0};
+  std::atomic<uint64_t> decompress_ns_{0};
+};
+
+} // namespace mrpc
+
+#endif // MRPC_COMPRESSION_H_
@@ -1,94 +1,69 @@
 #include "message.h"
 
+#include <algorithm>
+#include <cstring>
+
 namespace mrpc {
 
 ///////////////
-// MessageBuf
+// RpcMessage
 ///////////////
-MessageBuf::MessageBuf() {
-  capacity_ = GROW_SIZE;
-  data_ = (char*)malloc(capacity_);
-  // set pointers for write buffer and read buffer.
-  setp(data_, data_ + capacity_);
-  setg(data_, data_, data_ + capacity_);
-}
-MessageBuf::~MessageBuf() {
-  if (data_ != nullptr) {
-    free(data_);
-    data_ = nullptr;
-    capacity_ = 0;
-  }
+RpcMessage::RpcMessage() {
+  memset(&header_, 0, sizeof(FrameHeader));
+  header_.magic = MAGIC;
+  header_.version = VERSION;
 }
 
-void MessageBuf::Reset() {
-  memset(data_, 0, sizeof(char) * capacity_);
-  setp(data_, data_ + capacity_); // For writer buffer.(put)
-  setg(data_, data_, data_ + capacity_); // For Read buffer.(get)
-}
-
-void MessageBuf::Grow(int grow_size, bool is_from_tail) {
-  int new_size = capacity_ + grow_size;
-  char * new_buf = (char *)realloc(data_, new_size);
-  // Reset write buffer, (start, The location of the element you are writing, end)
-  // (pptr() - data_): The number of elements you have written.
-  // (gptr() - data_): The number of elements you have read.
-  if (is_from_tail) {
-    setp(new_buf, new_buf + (pptr() - data_), new_buf + new_size);
-    setg(new_buf, new_buf + (gptr() - data_), new_buf + new_size);
+bool RpcMessage::UnpackHeader(uint64_t max_body_length) {
+  if (header_.magic != MAGIC || header_.version != VERSION ||
+    header_.body_length > std::min(max_body_length, MAX_BODY_LENGTH)) {
+    return false;
   }
-  else {
-    setp(new_buf, new_buf + (pptr() - data_) + grow_size, new_buf + new_size);
-    setg(new_buf, new_buf + (gptr() - data_) + grow_size, new_buf + new_size);
-  }
-  data_ = new_buf;
-  capacity_ = new_size;
+  // Nothing is allocated for the body until it arrives.
+  buffer_.Clear();
+  buffer_.set_compact((header_.flags & FLAG_COMPACT) != 0);
+  return true;
 }
 
-// Override.
-// It is called when the data overflows. 
-int MessageBuf::overflow(int c) {
-  // Grow.
-  if (capacity_ + GROW_SIZE <= MAX_SIZE)
-    Grow(GROW_SIZE);
-  else
-    setp(data_, data_, data_ + capacity_);
-  // Write.
-  sputc(c);
-  return c;
+void RpcMessage::AppendBody(Buffer &inbound) {
+  std::size_t length = (std::size_t)std::min<uint64_t>(inbound.remaining(), body_missing());
+  if (length == 0)
+    return;
+  buffer_.Reserve(length);
+  inbound.Read(buffer_.tail(), length);
+  buffer_.Commit(length);
 }
 
-///////////////
-// Message
-///////////////
-Message::Message() {
-  ostream_ = new std::ostream(&buffer_);
-  istream_ = new std::istream(&buffer_);
-}
-Message::~Message() {
-  delete ostream_;
-  delete istream_;
+char *RpcMessage::PrepareBody(std::size_t *length) {
+  *length = (std::size_t)std::min<uint64_t>(body_missing(), std::max(BODY_STEP, buffer_.size()));
+  buffer_.Reserve(*length);
+  return buffer_.tail();
 }
 
-void Message::Ready4Pack() {
-  buffer_.Reset();
-  ostream_->set_rdbuf(&buffer_);
+void RpcMessage::InitBatch() {
+  Ready4Pack();
+  buffer_.set_compact(false);
+  header_.magic = MAGIC;
+  header_.version = VERSION;
+  header_.flags = FLAG_BATCH;
+  header_.status = STATUS_OK;
+  header_.body_length = 0;
 }
-void Message::Ready4Unpack() {
-  //ostream_->set_rdbuf(&buffer_);
-  //ostream_->write(data, size);
-  istream_->set_rdbuf(&buffer_);
+
+void RpcMessage::AppendFrame(RpcMessage &frame) {
+  buffer_.Write(frame.header(), frame.header_length());
+  buffer_.Write(frame.body(), frame.body_length());
+  header_.body_length = buffer_.size();
 }
 
-///////////////
-// RpcMessage
-///////////////
-bool RpcMessage::UnpackHeader() {
-  header_[HEADER_LENGTH - 1] = '\0';
-  body_length_ = std::atoi(header_);
-  //buffer_.Reset();
-  buffer_.GrowTo(body_length_);
-  body_ = buffer_.data();
+bool RpcMessage::NextFrame(RpcMessage *frame) {
+  if (buffer_.remaining() < frame->header_length())
+    return false;
+  buffer_.Read(frame->header(), frame->header_length());
+  if (frame->header_.body_length > buffer_.remaining() || !frame->UnpackHeader())
+    return false;
+  frame->AppendBody(buffer_);
   return true;
 }
 
-} // namespace mrpc
\ No newline at end of file
+} // namespace mrpc
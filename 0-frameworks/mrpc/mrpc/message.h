@@ -2,117 +2,211 @@
 #define MRPC_MESSAGE_H_
 
 #include <iostream>
-#include <sstream>
-#include <streambuf>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
 
+#include "buffer.h"
 #include "serializer.h"
 
 namespace mrpc {
 
-class MessageBuf : public std::stringbuf {
-  const static size_t GROW_SIZE = 5;
-  const static size_t MAX_SIZE = 55;
-
+class Message {
 public:
-  MessageBuf();
-  ~MessageBuf();
-
-  inline char *data() { return data_; }
-  inline const int size() const { return pptr() - pbase(); }
-  inline const int capacity() const { return capacity_; }
+  inline Buffer &buffer() { return buffer_; }
 
-  void Reset();
-  void Grow(int grow_size, bool is_from_tail = true);
+  inline void Ready4Pack() { buffer_.Clear(); }
+  inline void Ready4Unpack() { buffer_.Rewind(); }
 
-  inline void GrowTo(int size, bool is_from_tail = true) {
-    if (capacity_ < size) { Grow(size - capacity_, is_from_tail); }
+  template <class... Args>
+  inline void Pack(Args&... args) {
+    // Reserve ahead by the size pass, so that it is allocated once.
+    buffer_.Reserve(Serializer::Size(buffer_, args...));
+    Serializer::Dump(buffer_, args...);
+  }
+  template <class... Args>
+  inline void Unpack(Args&... args) {
+    Serializer::Load(buffer_, args...);
   }
 
 protected:
-  int overflow(int c);
+  Buffer buffer_; // Only for Body.
+};
 
-  inline int underflow() override { return ' '; }
-  inline int uflow() override {
-    setg(data_, data_, data_ + capacity_);
-    return EOF;
+// Methods are identified on the wire by a 32-bit FNV-1a hash of their names,
+// which can be computed at compile time, eg. constexpr auto id = MethodId("add");
+constexpr uint32_t MethodId(std::string_view name) {
+  uint32_t hash = 2166136261u;
+  for (char c : name) {
+    hash = (hash ^ (uint8_t)c) * 16777619u;
   }
+  return hash;
+}
+
+enum StatusCode {
+  STATUS_OK = 0,
+  STATUS_NOT_FOUND = 1,    // Unknown method id.
+  STATUS_BAD_REQUEST = 2,  // The arguments can not be unpacked.
+  STATUS_IO_ERROR = 3,     // Set by the client if the connection failed.
+  STATUS_OVERLOADED = 4,   // Rejected by the server to protect itself.
+  STATUS_DEADLINE_EXCEEDED = 5, // The timeout of the call has passed.
+  STATUS_INTERNAL_ERROR = 6  // A coroutine handler has thrown.
+};
 
-private:
-  char *data_;
-  int capacity_;
+// Bits of FrameHeader::flags.
+enum FrameFlag {
+  // The body is in the compact encoding, see Serializer::Varint.
+  FLAG_COMPACT = 0x01,
+  // A frame of a streaming call: the request, a chunk in either 
+  // direction, or the end mark if FLAG_END is set as well.
+  FLAG_STREAM = 0x02,
+  FLAG_END = 0x04,
+  // Flow control of a stream, the body is the number of chunks 
+  // (uint32_t) that the peer is allowed to send in addition.
+  FLAG_CREDIT = 0x08,
+  // The body is a sequence of whole frames (header and body) of small
+  // calls, or of their responses, see Client::set_batching().
+  FLAG_BATCH = 0x10,
+  // A vectorized call, the body is a vector of argument sets and the
+  // response is a vector of the results, see Client::CallMany().
+  FLAG_MANY = 0x20,
+  // The body is compressed, and the sender accepts compressed frames,
+  // see Compression.
+  FLAG_COMPRESSED = 0x40,
+  FLAG_ACCEPT_COMPRESSION = 0x80
 };
 
-class Message {
+// Binary frame header, sent in front of every message body.
+// Fields are kept in host byte order, the same as Serializer does for PODs.
+struct FrameHeader {
+  uint32_t magic;
+  uint8_t version;
+  uint8_t flags;
+  uint16_t status;
+  uint32_t method_id;
+  // The time budget of a request in microseconds, 0 for none. It is 
+  // relative, so that the clocks of the two hosts do not matter.
+  uint32_t timeout_us;
+  uint64_t request_id;
+  uint64_t body_length;
+};
+static_assert(sizeof(FrameHeader) == 32, "FrameHeader should be packed into 32 bytes.");
+
+class RpcMessage :public Message{
 public:
-  Message();
-  ~Message();
+  static const uint32_t MAGIC = 0x4D525043; // "MRPC"
+  static const uint8_t VERSION = 1;
+  // The largest body of the protocol.
+  static constexpr uint64_t MAX_BODY_LENGTH = 1ull << 32;
+  // The default limit of a server on the bodies it accepts, see
+  // Server::SetMaxBodyLength().
+  static constexpr uint64_t DEFAULT_MAX_BODY_LENGTH = 64ull << 20;
+  // The body is received in steps of at most this, or of the size that has
+  // been received so far if larger. So a header with a large length does
+  // not allocate more than what is actually sent.
+  static constexpr std::size_t BODY_STEP = 64 * 1024;
 
-  inline std::string &buffer_str() { return buffer_str_; }
+public:
+  RpcMessage();
 
-  void Ready4Pack();
-  void Ready4Unpack();
+  // Views of the serialized body, valid until the next Pack/UnpackHeader.
+  inline char *body() const { return buffer_.data(); }
+  inline std::size_t body_length() const { return buffer_.size(); }
 
-  template <class... Args>
-  inline void Pack(Args&... args) {
-    Serializer::Dump(*ostream_, args...);
-    buffer_str_ = buffer_.str();
-  }
-  template <class... Args>
-  inline void Unpack(Args&... args) {
-    Serializer::Load(*istream_, args...);
-  }
+  inline char *header() { return (char *)&header_; }
+  inline std::size_t header_length() const { return sizeof(FrameHeader); }
 
-protected:
-  MessageBuf buffer_; // Only for Body.
+  inline uint64_t request_id() const { return header_.request_id; }
+  inline void set_request_id(uint64_t id) { header_.request_id = id; }
 
-private:   
-  std::string buffer_str_;
-  std::ostream *ostream_;
-  std::istream *istream_;
-};
+  inline uint32_t method_id() const { return header_.method_id; }
+  inline void set_method_id(uint32_t id) { header_.method_id = id; }
 
-class RpcMessage :public Message{
-  enum { 
-    HEADER_LENGTH = 5,
-    BASE_BODY_LENGTH = 1024,
-    BODY_GROW_LENGTH = 1024
-  };
+  inline StatusCode status() const { return (StatusCode)header_.status; }
+  inline void set_status(StatusCode status) { header_.status = status; }
 
-public:
-  inline char *body() const { return body_; }
-  inline std::size_t body_length() const { return body_length_; }
+  inline uint8_t flags() const { return header_.flags; }
+  inline void set_flags(uint8_t flags) { header_.flags = flags; }
+
+  inline uint32_t timeout_us() const { return header_.timeout_us; }
+  inline void set_timeout_us(uint32_t timeout) { header_.timeout_us = timeout; }
 
-  inline char *header() { return header_; }
-  inline std::size_t header_length() const { return HEADER_LENGTH; }
+  // When a request was received, set by the server. The request expires
+  // timeout_us after it.
+  inline std::chrono::steady_clock::time_point received_at() const { return received_at_; }
+  inline void set_received_at(std::chrono::steady_clock::time_point t) { received_at_ = t; }
+  inline bool IsExpired(std::chrono::steady_clock::time_point now) const {
+    return header_.timeout_us > 0 && now - received_at_ > std::chrono::microseconds(header_.timeout_us);
+  }
+
+  // Pack with the compact encoding. It is taken from the flags of the
+  // header on unpacking, so a response follows the encoding of its request.
+  inline bool is_compact() const { return buffer_.is_compact(); }
+  inline void set_compact(bool is_compact) { buffer_.set_compact(is_compact); }
 
+  // Serialize the body. The routing fields of the header (method id,
+  // request id, status) are left as they are, so a request can be
+  // packed in place as its own response.
   template <class... Args>
-  void Pack(std::string func_name, Args&... args) {
+  void Pack(Args&... args) {
     Ready4Pack();
-    Message::Pack(func_name, args...);
+    Message::Pack(args...);
 
-    body_ = (char *)buffer_str().c_str();
-    body_length_ = buffer_str().length();
+    header_.magic = MAGIC;
+    header_.version = VERSION;
+    header_.flags = buffer_.is_compact() ? (header_.flags | FLAG_COMPACT) 
+                                         : (header_.flags & ~FLAG_COMPACT);
+    header_.body_length = buffer_.size();
+  }
+
+  // Set the serialized body directly, eg. a copy of a cached response.
+  void PackRaw(const char *body, size_t length) {
+    Ready4Pack();
+    buffer_.Write(body, length);
 
-    std::sprintf(header_, "%4d", body_length_);
+    header_.magic = MAGIC;
+    header_.version = VERSION;
+    header_.flags = buffer_.is_compact() ? (header_.flags | FLAG_COMPACT) 
+                                         : (header_.flags & ~FLAG_COMPACT);
+    header_.body_length = buffer_.size();
   }
 
-  bool UnpackHeader();
+  // Exchange the body with another buffer, eg. for compressing it out of
+  // place. The encoding of the body is kept.
+  void SwapBody(Buffer &body) {
+    bool is_compact = buffer_.is_compact();
+    buffer_.Swap(body);
+    buffer_.set_compact(is_compact);
+    header_.body_length = buffer_.size();
+  }
+
+  // Check the header that has just been read, and empty the body for
+  // receiving it. Returns false if the frame is invalid, or its body is
+  // longer than max_body_length.
+  bool UnpackHeader(uint64_t max_body_length = MAX_BODY_LENGTH);
+  // Receiving the body after UnpackHeader(): AppendBody() takes what is
+  // already in inbound, then PrepareBody() gives the room for the next
+  // step to read into and CommitBody() counts it, until body_missing() is 0.
+  inline uint64_t body_missing() const { return header_.body_length - buffer_.size(); }
+  void AppendBody(Buffer &inbound);
+  char *PrepareBody(std::size_t *length);
+  inline void CommitBody(std::size_t length) { buffer_.Commit(length); }
 
   template <typename T>
   inline void GetArgs(T &t) { Message::Unpack(t); }
 
-  inline void GetFuncName(std::string &func_name) {
-    Ready4Unpack();
-    GetArgs(func_name);
-  }
+  // Batch frames. InitBatch() starts an empty batch with the routing
+  // fields left as they are, AppendFrame() copies a packed frame into it,
+  // and NextFrame() takes the frames out one by one after Ready4Unpack().
+  void InitBatch();
+  void AppendFrame(RpcMessage &frame);
+  // Returns false if the rest of the body is not a valid frame.
+  bool NextFrame(RpcMessage *frame);
 
 private:
-  std::string func_name_;
-
-  char header_[HEADER_LENGTH];
-  char *body_;
-  size_t body_length_;
+  FrameHeader header_;
+  std::chrono::steady_clock::time_point received_at_;
 };
 
 } //namespace mrpc
-#endif // MRPC_MESSAGE_H_
\ No newline at end of file
+#endif // MRPC_MESSAGE_H_
@@ -0,0 +1,214 @@
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace mrpc {
+
+thread_local Metrics::ArgSizes Metrics::arg_sizes_;
+
+Metrics &Metrics::Instance() {
+  // Never destroyed, the threads may exit after the static destructors.
+  static Metrics *instance = new Metrics;
+  return *instance;
+}
+
+Metrics::ThreadStats::ThreadStats() {
+  Metrics &metrics = Instance();
+  std::lock_guard<std::mutex> lock(metrics.mutex_);
+  metrics.threads_.push_back(this);
+}
+
+Metrics::ThreadStats::~ThreadStats() {
+  Metrics &metrics = Instance();
+  std::lock_guard<std::mutex> lock(metrics.mutex_);
+  for (size_t i = 0; i < metrics.threads_.size(); i++) {
+    if (metrics.threads_[i] == this) {
+      metrics.threads_.erase(metrics.threads_.begin() + i);
+      break;
+    }
+  }
+  // Keep the counts of this thread.
+  for (int i = 0; i < MAX_METHODS; i++) {
+    MethodStats *stats = methods[i].load(std::memory_order_acquire);
+    if (stats == nullptr)
+      continue;
+    if (metrics.retired_[i] == nullptr)
+      metrics.retired_[i] = new MethodStats;
+    Merge(*stats, metrics.retired_[i]);
+    delete stats;
+  }
+}
+
+Metrics::ThreadStats &Metrics::Local() {
+  static thread_local ThreadStats local;
+  return local;
+}
+
+MethodStats *Metrics::Get(int index) {
+  std::atomic<MethodStats *> &slot = Local().methods[index];
+  MethodStats *stats = slot.load(std::memory_order_relaxed);
+  if (stats == nullptr) {
+    stats = new MethodStats;
+    slot.store(stats, std::memory_order_release);
+  }
+  return stats;
+}
+
+int Metrics::Register(uint32_t method_id, const std::string &func_name) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = indices_.find(method_id);
+  if (iter != indices_.end())
+    return iter->second;
+  if (names_.size() >= (size_t)MAX_METHODS)
+    return -1;
+
+  int index = names_.size();
+  names_.push_back(func_name);
+  retired_.push_back(nullptr);
+  indices_[method_id] = index;
+  return index;
+}
+
+void Metrics::Record(int index, uint64_t latency, uint64_t bytes_in, 
+                     uint64_t bytes_out, bool is_error) {
+  if (index < 0)
+    return;
+  MethodStats *stats = Get(index);
+  MethodStats::Increase(stats->calls, 1);
+  if (is_error)
+    MethodStats::Increase(stats->errors, 1);
+  MethodStats::Increase(stats->bytes_in, bytes_in);
+  MethodStats::Increase(stats->bytes_out, bytes_out);
+  MethodStats::Increase(stats->latency_sum, latency);
+  MethodStats::Increase(stats->latency[LatencyHistogram::Index(latency)], 1);
+
+  if (latency >= slow_threshold_.load(std::memory_order_relaxed))
+    SampleSlowCall(index, latency, bytes_in, bytes_out);
+}
+
+void Metrics::RecordError(int index) {
+  if (index < 0)
+    return;
+  MethodStats *stats = Get(index);
+  MethodStats::Increase(stats->calls, 1);
+  MethodStats::Increase(stats->errors, 1);
+}
+
+void Metrics::RecordCache(int index, CacheResult result) {
+  if (index < 0)
+    return;
+  MethodStats::Increase(Get(index)->cache[result], 1);
+}
+
+void Metrics::SampleSlowCall(int index, uint64_t latency, uint64_t bytes_in, uint64_t bytes_out) {
+  SlowCall call;
+  call.index = index;
+  call.latency = latency;
+  call.bytes_in = bytes_in;
+  call.bytes_out = bytes_out;
+  call.arg_sizes.assign(arg_sizes_.sizes, arg_sizes_.sizes + arg_sizes_.count);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  slow_calls_.push_back(std::move(call));
+  if (slow_calls_.size() > MAX_SLOW_CALLS)
+    slow_calls_.pop_front();
+}
+
+void Metrics::Merge(const MethodStats &src, MethodStats *dst) {
+  dst->calls += src.calls.load(std::memory_order_relaxed);
+  dst->errors += src.errors.load(std::memory_order_relaxed);
+  dst->bytes_in += src.bytes_in.load(std::memory_order_relaxed);
+  dst->bytes_out += src.bytes_out.load(std::memory_order_relaxed);
+  dst->latency_sum += src.latency_sum.load(std::memory_order_relaxed);
+  for (int i = 0; i < LatencyHistogram::NUM_BUCKETS; i++)
+    dst->latency[i] += src.latency[i].load(std::memory_order_relaxed);
+  for (int i = 0; i <= CACHE_MISS; i++)
+    dst->cache[i] += src.cache[i].load(std::memory_order_relaxed);
+}
+
+std::string Metrics::ToJson() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::string json = "{\n  \"methods\": [";
+  char line[512];
+  bool is_first = true;
+  for (size_t i = 0; i < names_.size(); i++) {
+    MethodStats total;
+    if (retired_[i] != nullptr)
+      Merge(*retired_[i], &total);
+    for (ThreadStats *thread : threads_) {
+      MethodStats *stats = thread->methods[i].load(std::memory_order_acquire);
+      if (stats != nullptr)
+        Merge(*stats, &total);
+    }
+    uint64_t calls = total.calls;
+    uint64_t lookups = total.cache[CACHE_HIT] + total.cache[CACHE_COALESCED] + total.cache[CACHE_MISS];
+    if (calls == 0 && lookups == 0)
+      continue;
+
+    // The percentiles of the calls that have been applied.
+    uint64_t num_applied = 0;
+    for (int b = 0; b < LatencyHistogram::NUM_BUCKETS; b++)
+      num_applied += total.latency[b];
+    const double percentiles[] = { 50, 99, 99.9 };
+    double values[3] = { 0, 0, 0 };
+    for (int p = 0; p < 3 && num_applied > 0; p++) {
+      uint64_t rank = std::max<uint64_t>(1, (uint64_t)(percentiles[p] / 100 * num_applied + 0.5));
+      uint64_t seen = 0;
+      for (int b = 0; b < LatencyHistogram::NUM_BUCKETS; b++) {
+        seen += total.latency[b];
+        if (seen >= rank) {
+          values[p] = LatencyHistogram::HighestEquivalent(b) / 1e3;
+          break;
+        }
+      }
+    }
+
+    snprintf(line, sizeof(line), 
+      "%s\n    {\"name\": \"%s\", \"calls\": %llu, \"errors\": %llu, "
+      "\"bytes_in\": %llu, \"bytes_out\": %llu, \"latency_us\": {\"mean\": %.2f, "
+      "\"p50\": %.2f, \"p99\": %.2f, \"p999\": %.2f}",
+      is_first ? "" : ",", names_[i].c_str(), (unsigned long long)calls,
+      (unsigned long long)total.errors, (unsigned long long)total.bytes_in,
+      (unsigned long long)total.bytes_out,
+      num_applied ? total.latency_sum / 1e3 / num_applied : 0.0,
+      values[0], values[1], values[2]);
+    json += line;
+    // Only for the idempotent methods. The hit rate is the share of the
+    // lookups answered without running the handler.
+    if (lookups > 0) {
+      snprintf(line, sizeof(line),
+        ", \"cache\": {\"hits\": %llu, \"coalesced\": %llu, \"misses\": %llu, \"hit_rate\": %.4f}",
+        (unsigned long long)total.cache[CACHE_HIT], (unsigned long long)total.cache[CACHE_COALESCED],
+        (unsigned long long)total.cache[CACHE_MISS],
+        (double)(total.cache[CACHE_HIT] + total.cache[CACHE_COALESCED]) / lookups);
+      json += line;
+    }
+    json += "}";
+    is_first = false;
+  }
+
+  snprintf(line, sizeof(line), "\n  ],\n  \"slow_threshold_us\": %.2f,\n  \"slow_calls\": [",
+           slow_threshold_ / 1e3);
+  json += line;
+  is_first = true;
+  for (const SlowCall &call : slow_calls_) {
+    snprintf(line, sizeof(line),
+      "%s\n    {\"name\": \"%s\", \"latency_us\": %.2f, \"bytes_in\": %llu, "
+      "\"bytes_out\": %llu, \"arg_sizes\": [",
+      is_first ? "" : ",", names_[call.index].c_str(), call.latency / 1e3,
+      (unsigned long long)call.bytes_in, (unsigned long long)call.bytes_out);
+    json += line;
+    for (size_t a = 0; a < call.arg_sizes.size(); a++) {
+      if (a > 0)
+        json += ", ";
+      json += std::to_string(call.arg_sizes[a]);
+    }
+    json += "]}";
+    is_first = false;
+  }
+  json += "\n  ]\n}\n";
+  return json;
+}
+
+} // namespace mrpc
@@ -0,0 +1,167 @@
+#ifndef MRPC_METRICS_H_
+#define MRPC_METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace mrpc {
+
+// Latency histogram with 8 buckets per power of two (about 10% precision)
+// over the whole range of uint64_t nanoseconds. There is a single writer,
+// so the counters are atomic only for the readers on the other threads.
+class LatencyHistogram {
+  const static int SUB_BUCKET_BITS = 3;
+  const static int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+
+public:
+  const static int NUM_BUCKETS = SUB_BUCKET_COUNT * (64 - SUB_BUCKET_BITS + 1);
+
+  static inline int Index(uint64_t value) {
+    if (value < SUB_BUCKET_COUNT)
+      return (int)value;
+    int shift = HighestBit(value) - SUB_BUCKET_BITS;
+    return SUB_BUCKET_COUNT * (shift + 1) + (int)((value >> shift) - SUB_BUCKET_COUNT);
+  }
+  // The upper bound of the values counted by the bucket.
+  static inline uint64_t HighestEquivalent(int index) {
+    if (index < SUB_BUCKET_COUNT)
+      return index;
+    int shift = index / SUB_BUCKET_COUNT - 1;
+    uint64_t sub_bucket = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+    return ((sub_bucket + 1) << shift) - 1;
+  }
+
+private:
+  static inline int HighestBit(uint64_t value) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanReverse64(&index, value);
+    return (int)index;
+#else
+    return 63 - __builtin_clzll(value);
+#endif
+  }
+};
+
+// The result of looking up the response cache of an idempotent method,
+// see ResponseCache.
+enum CacheResult {
+  CACHE_HIT = 0,
+  CACHE_COALESCED, // Answered by an identical call in flight.
+  CACHE_MISS
+};
+
+// Counters of one method on one thread.
+struct MethodStats {
+  std::atomic<uint64_t> calls{0};
+  std::atomic<uint64_t> errors{0};
+  std::atomic<uint64_t> bytes_in{0};
+  std::atomic<uint64_t> bytes_out{0};
+  std::atomic<uint64_t> latency_sum{0}; // ns
+  std::atomic<uint64_t> latency[LatencyHistogram::NUM_BUCKETS] = {};
+  std::atomic<uint64_t> cache[CACHE_MISS + 1] = {};
+
+  // Only by the owner thread: plain load and store, no locked instruction.
+  static inline void Increase(std::atomic<uint64_t> &counter, uint64_t n) {
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+};
+
+// Per-method server metrics of this process: calls, errors, body bytes in
+// and out, and the handler latency, which are kept in per-thread storage
+// so that recording a call takes no lock and shares no cache line with
+// the other threads. They are only summed up when they are read. The
+// calls are the runs of the handler, the ones answered by the response
+// cache are only counted as its hits. Calls
+// slower than the threshold are also sampled with the serialized size of
+// each of their arguments, the most recent ones are kept.
+//
+// The methods are registered by name, so the processors of all the threads
+// of a server share the entries of the same method.
+class Metrics {
+  const static int MAX_METHODS = 1024;
+  const static int MAX_ARGS = 16;
+  const static size_t MAX_SLOW_CALLS = 64;
+
+  struct SlowCall {
+    int index;
+    uint64_t latency; // ns
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    std::vector<uint32_t> arg_sizes;
+  };
+
+  struct ThreadStats {
+    std::atomic<MethodStats *> methods[MAX_METHODS] = {};
+    // Registered in threads_ while the thread is alive.
+    ThreadStats();
+    ~ThreadStats();
+  };
+
+public:
+  // Serialized sizes of the arguments of the call being applied on this
+  // thread, filled while the arguments are unpacked.
+  struct ArgSizes {
+    int count;
+    uint32_t sizes[MAX_ARGS];
+
+    inline void Add(size_t size) {
+      if (count < MAX_ARGS)
+        sizes[count++] = (uint32_t)size;
+    }
+  };
+
+  static Metrics &Instance();
+  static inline ArgSizes &arg_sizes() { return arg_sizes_; }
+
+  // Returns the index of the method for Record(), or -1 if there are
+  // too many methods to be tracked.
+  int Register(uint32_t method_id, const std::string &func_name);
+
+  void Record(int index, uint64_t latency, uint64_t bytes_in, uint64_t bytes_out, bool is_error);
+  // A call that has not been run, eg. rejected by a full worker pool.
+  void RecordError(int index);
+  void RecordCache(int index, CacheResult result);
+
+  // Calls that take at least this long are sampled, 10ms by default.
+  inline void set_slow_threshold(uint64_t ns) { slow_threshold_ = ns; }
+  inline uint64_t slow_threshold() const { return slow_threshold_; }
+
+  // All the counters as JSON, it is the response of the built-in "__stats".
+  std::string ToJson();
+
+private:
+  Metrics() : slow_threshold_(10 * 1000 * 1000) {}
+
+  ThreadStats &Local();
+  MethodStats *Get(int index);
+  void SampleSlowCall(int index, uint64_t latency, uint64_t bytes_in, uint64_t bytes_out);
+  // Add the counters of src into dst.
+  static void Merge(const MethodStats &src, MethodStats *dst);
+
+private:
+  static thread_local ArgSizes arg_sizes_;
+
+  std::atomic<uint64_t> slow_threshold_;
+
+  std::mutex mutex_;
+  std::unordered_map<uint32_t, int> indices_;
+  std::vector<std::string> names_;
+  std::vector<ThreadStats *> threads_;
+  // The counters of the threads that have exited.
+  std::vector<MethodStats *> retired_;
+  std::deque<SlowCall> slow_calls_;
+};
+
+} // namespace mrpc
+
+#endif // MRPC_METRICS_H_
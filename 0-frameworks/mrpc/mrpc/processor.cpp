@@ -1,31 +1,136 @@
 #include "processor.h"
 
+#include <chrono>
+
 namespace mrpc {
 
-Processor::Processor() {
-  items_.clear();
+Processor::Processor() : pool_(nullptr), admission_(nullptr), compression_(nullptr),
+                         max_body_length_(RpcMessage::DEFAULT_MAX_BODY_LENGTH), num_items_(0) {
+  // Built-in method for discovery.
+  Bind<std::vector<std::string>>("__methods", [this]() { return FuncNames(); });
+  // Per-method metrics of this process as JSON, see Metrics.
+  Bind<std::string>("__stats", []() { return Metrics::Instance().ToJson(); });
 }
 
 Processor::~Processor() {
-  std::map<std::string, Item* >::iterator iter;
-  for (iter = items_.begin(); iter != items_.end(); iter++) {
-    delete iter->second;
+  for (size_t i = 0; i < table_.size(); i++) {
+    if (table_[i].item != nullptr)
+      delete table_[i].item;
+  }
+}
+
+void Processor::Insert(uint32_t method_id, Item *item) {
+  // Keep the load factor no more than 0.5, so that the probe sequences
+  // stay short. Rehash into a larger table if needed.
+  if ((num_items_ + 1) * 2 > table_.size()) {
+    std::vector<Slot> old;
+    old.swap(table_);
+    table_.resize(old.empty() ? 16 : old.size() * 2, Slot{ 0, nullptr });
+    num_items_ = 0;
+    for (size_t i = 0; i < old.size(); i++) {
+      if (old[i].item != nullptr)
+        Insert(old[i].method_id, old[i].item);
+    }
   }
+
+  size_t mask = table_.size() - 1;
+  size_t i = method_id & mask;
+  while (table_[i].item != nullptr)
+    i = (i + 1) & mask;
+  table_[i].method_id = method_id;
+  table_[i].item = item;
+  num_items_++;
+  if (item->stats_index() < 0)
+    item->set_stats_index(Metrics::Instance().Register(method_id, item->func_name()));
 }
 
-void Processor::Run(RpcMessage &message) {
-  std::string func_name;
-  message.GetFuncName(func_name);
-    
-  Item *item = items_[func_name];
+std::vector<std::string> Processor::FuncNames() const {
+  std::vector<std::string> names;
+  for (size_t i = 0; i < table_.size(); i++) {
+    if (table_[i].item != nullptr)
+      names.push_back(table_[i].item->func_name());
+  }
+  return names;
+}
+
+std::shared_ptr<ResponseCache> Processor::GetCache(const std::string &func_name) const {
+  Item *item = Find(MethodId(func_name));
+  return item != nullptr ? item->cache() : nullptr;
+}
+
+void Processor::SetCache(const std::string &func_name, const std::shared_ptr<ResponseCache> &cache) {
+  Item *item = Find(MethodId(func_name));
+  if (item != nullptr)
+    item->set_cache(cache);
+}
+
+Stream *Processor::Open(RpcMessage &message) {
+  Item *item = Find(message.method_id());
+  message.Ready4Unpack();
+  message.set_status(STATUS_OK);
+  if (item == nullptr || !item->is_stream()) {
+    std::string msg = "Can not find the streaming function [" +
+      std::to_string(message.method_id()) + "]";
+    message.set_status(STATUS_NOT_FOUND);
+    message.set_flags(message.flags() & ~(FLAG_STREAM | FLAG_END));
+    message.Pack(msg);
+    return nullptr;
+  }
+  Stream *stream = item->Open(message);
+  if (stream == nullptr)
+    message.set_flags(message.flags() & ~(FLAG_STREAM | FLAG_END));
+  return stream;
+}
+
+void Processor::Reject(Item *item, RpcMessage &message, StatusCode status, const char *reason) {
+  std::string name = std::to_string(message.method_id());
+  if (item != nullptr) {
+    Metrics::Instance().RecordError(item->stats_index());
+    name = item->func_name();
+  }
+  std::string msg = std::string(reason) + " [" + name + "]";
+  message.set_status(status);
+  message.Pack(msg);
+}
+
+void Processor::Apply(Item *item, RpcMessage &message) {
+  message.Ready4Unpack();
+  message.set_status(STATUS_OK);
   if (item == nullptr) {
-    std::string msg = "Can not find the function [" + func_name + "]";
+    std::string msg = "Can not find the function [" + 
+      std::to_string(message.method_id()) + "]";
+    message.set_status(STATUS_NOT_FOUND);
     message.Pack(msg);
   }
   else {
-    std::cout << "Apply function: " << func_name << std::endl;
-    item->Apply(message);
+    uint64_t bytes_in = message.body_length();
+    auto start = std::chrono::steady_clock::now();
+    if (message.flags() & FLAG_MANY)
+      item->ApplyMany(message, item->policy() == EXEC_POOL ? pool_ : nullptr);
+    else
+      item->Apply(message);
+    uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    Metrics::Instance().Record(item->stats_index(), latency, bytes_in,
+                               message.body_length(), message.status() != STATUS_OK);
   }
 }
 
+void Processor::Spawn(Item *item, RpcMessage &message, const asio::any_io_executor &executor,
+                      std::function<void()> done) {
+  message.Ready4Unpack();
+  message.set_status(STATUS_OK);
+  uint64_t bytes_in = message.body_length();
+  auto start = std::chrono::steady_clock::now();
+  // The latency includes the time it is suspended, eg. in nested calls.
+  item->Spawn(message, executor,
+    [item, bytes_in, start, &message, done = std::move(done)]() {
+    uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now() - start).count();
+    Metrics::Instance().Record(item->stats_index(), latency, bytes_in,
+                               message.body_length(), message.status() != STATUS_OK);
+    done();
+  });
+}
+
 } // namespace mrpc
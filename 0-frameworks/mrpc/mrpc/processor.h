@@ -2,11 +2,20 @@
 #define MRPC_PROCESSOR_H_
 
 #include <iostream>
+#include <chrono>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <tuple>
-#include <map>
+#include <vector>
 
+#include "asio.hpp"
+#include "admission.h"
+#include "compression.h"
 #include "message.h"
+#include "metrics.h"
+#include "response_cache.h"
+#include "thread_pool.h"
 
 namespace mrpc {
 
@@ -15,70 +24,562 @@ struct _identity {
   typedef T type;
 };
 
+// Whether a handler returns asio::awaitable, ie. it is a coroutine.
+template <typename T>
+struct IsAwaitable : std::false_type {};
+#if defined(ASIO_HAS_CO_AWAIT)
+template <typename T, typename Executor>
+struct IsAwaitable<asio::awaitable<T, Executor>> : std::true_type {};
+#endif
+
+// Where a handler is executed.
+enum ExecPolicy {
+  // On the I/O thread of the session, for the cheap handlers.
+  EXEC_INLINE = 0,
+  // On the worker pool of the server, so that a slow handler does not
+  // stall the other sessions on the same I/O thread. Such handlers may
+  // run on several threads at the same time.
+  EXEC_POOL = 1
+};
+
+// State of a streaming call on the server, created per call.
+class Stream {
+public:
+  virtual ~Stream() {}
+  inline bool is_server_stream() const { return is_server_stream_; }
+
+  // Server-streaming: pack the next chunk into message. 
+  // Returns false if there is no more chunk.
+  virtual bool Next(RpcMessage &message) { return false; }
+  // Client-streaming: take in a chunk unpacked from message.
+  virtual void Consume(RpcMessage &message) {}
+  // Client-streaming: pack the response after the last chunk.
+  virtual void Finish(RpcMessage &message) {}
+
+protected:
+  bool is_server_stream_;
+};
+
+// Consumer of a client-streaming call, one is created for each call.
+template <typename Chunk, typename Response>
+class StreamSink {
+public:
+  virtual ~StreamSink() {}
+  virtual void OnChunk(Chunk &chunk) = 0;
+  virtual Response OnFinish() = 0;
+};
+
 class Item {
 public:
   virtual ~Item() {}
   virtual void Apply(RpcMessage &params) = 0;
+  // A vectorized call: the arguments are a vector of argument sets, the
+  // response is the vector of the results. They are run in parallel
+  // if a pool is given.
+  virtual void ApplyMany(RpcMessage &params, ThreadPool *pool) {
+    std::string msg = "[" + func_name_ + "] can not be called with many argument sets.";
+    params.set_status(STATUS_BAD_REQUEST);
+    params.Pack(msg);
+  }
+  // Only for the streaming methods, returns nullptr if the arguments
+  // can not be unpacked.
+  virtual Stream *Open(RpcMessage &params) { return nullptr; }
+  // Only for the coroutine methods: start the handler on the executor,
+  // and call done() there once the response has been packed.
+  virtual void Spawn(RpcMessage &params, const asio::any_io_executor &executor,
+                     std::function<void()> done) {
+    Apply(params);
+    done();
+  }
+
+  inline const std::string &func_name() const { return func_name_; }
+  inline ExecPolicy policy() const { return policy_; }
+  inline bool is_stream() const { return is_stream_; }
+  inline bool is_coroutine() const { return is_coroutine_; }
+
+  // The entry of this method in Metrics.
+  inline int stats_index() const { return stats_index_; }
+  inline void set_stats_index(int index) { stats_index_ = index; }
+
+  // Only for the idempotent methods, nullptr for the others.
+  inline const std::shared_ptr<ResponseCache> &cache() const { return cache_; }
+  inline void set_cache(const std::shared_ptr<ResponseCache> &cache) { cache_ = cache; }
+
+protected:
+  // Fill params, returns false if they can not be unpacked. The size of
+  // each argument is noted for the slow call samples of Metrics.
+  // note: std::apply and "fold expression" require c++17 support.
+  template<typename... Args>
+  static bool UnpackArgs(RpcMessage &params, std::tuple<Args...> &request) {
+    Metrics::ArgSizes &sizes = Metrics::arg_sizes();
+    sizes.count = 0;
+    std::apply([&params, &sizes](auto&&... args) {
+      ((UnpackArg(params, args, sizes)), ...);
+    }, request);
+    return params.buffer().good();
+  }
+
+  template<typename T>
+  static inline void UnpackArg(RpcMessage &params, T &arg, Metrics::ArgSizes &sizes) {
+    size_t begin = params.buffer().read_pos();
+    params.GetArgs(arg);
+    sizes.Add(params.buffer().read_pos() - begin);
+  }
+
+  void PackUnpackError(RpcMessage &params) {
+    std::string msg = "Failed to unpack the arguments of [" + func_name_ + "]";
+    params.set_status(STATUS_BAD_REQUEST);
+    params.Pack(msg);
+  }
+
+protected:
+  std::string func_name_;
+  ExecPolicy policy_ = EXEC_INLINE;
+  bool is_stream_ = false;
+  bool is_coroutine_ = false;
+  int stats_index_ = -1;
+  std::shared_ptr<ResponseCache> cache_;
 };
 
 template<typename Response, typename... Args>
 class DerivedItem : public Item {
+  static_assert(!IsView<Response>::value, 
+    "A view can not be returned, as it points into the buffer of the request.");
 
 public:
   DerivedItem(std::string &func_name, 
-    typename _identity<std::function<Response(Args&...)>>::type func) {
+    typename _identity<std::function<Response(Args&...)>>::type func,
+    ExecPolicy policy) {
     func_name_ = func_name;
+    policy_ = policy;
     handle_ = new std::function<Response(Args&...)>(func);
   }
   ~DerivedItem() { delete handle_; }
 
   virtual void Apply(RpcMessage &params) {
-    // Fill params.
-    // note: std::apply and "fold expression" require c++17 support.
-    std::apply([&params](auto&&... args) {
-      ((ParamsRecover(params, args)), ...);
-    }, request_);
+    // It is local, as the item may be applied by several threads at the same time.
+    std::tuple<Args...> request;
+    if (!UnpackArgs(params, request)) {
+      PackUnpackError(params);
+      return;
+    }
 
     // Calculate.
-    auto response = std::apply(*handle_, request_);
-    params.Pack(func_name_, response);
+    auto response = std::apply(*handle_, request);
+    params.Pack(response);
   }
 
-private:
-  template<typename T>
-  static void ParamsRecover(RpcMessage &params, T& t) {
-    params.GetArgs(t);
+  virtual void ApplyMany(RpcMessage &params, ThreadPool *pool) {
+    std::vector<std::tuple<Args...>> requests;
+    params.GetArgs(requests);
+    if (!params.buffer().good()) {
+      PackUnpackError(params);
+      return;
+    }
+    // A single entry for the slow call samples, the size of all the sets.
+    Metrics::ArgSizes &sizes = Metrics::arg_sizes();
+    sizes.count = 0;
+    sizes.Add(params.body_length());
+
+    // Each set writes its own slot, an optional so that the slots are 
+    // separate objects even for bool (unlike vector<bool>), and Response
+    // needs not be default-constructible.
+    std::vector<std::optional<Response>> slots(requests.size());
+    auto run = [this, &requests, &slots](size_t i) {
+      slots[i].emplace(std::apply(*handle_, requests[i]));
+    };
+    if (pool != nullptr && requests.size() > 1) {
+      pool->ParallelFor(requests.size(), run);
+    }
+    else {
+      for (size_t i = 0; i < requests.size(); i++)
+        run(i);
+    }
+    std::vector<Response> responses;
+    responses.reserve(slots.size());
+    for (auto &slot : slots)
+      responses.push_back(std::move(*slot));
+    params.Pack(responses);
   }
 
 private:
-  std::string func_name_;
-  std::tuple<Args...> request_;
   std::function<Response(Args&...)> *handle_;
 };
 
+#if defined(ASIO_HAS_CO_AWAIT)
+// The handler is a C++20 coroutine returning asio::awaitable<Response>,
+// so it can co_await other calls, eg. Client::CoCall(), without blocking
+// its thread. It runs on the executor of the session, and while it is
+// suspended the thread serves the other sessions. Its arguments stay
+// valid until it returns. An exception thrown by it is answered with
+// STATUS_INTERNAL_ERROR.
+template<typename Response, typename... Args>
+class CoroutineItem : public Item {
+  static_assert(!IsView<Response>::value, 
+    "A view can not be returned, as it points into the buffer of the request.");
+
+public:
+  typedef std::function<asio::awaitable<Response>(Args&...)> Handle;
+
+  CoroutineItem(std::string &func_name, typename _identity<Handle>::type func)
+    : handle_(func) {
+    func_name_ = func_name;
+    is_coroutine_ = true;
+  }
+
+  virtual void Apply(RpcMessage &params) {
+    std::string msg = "[" + func_name_ + "] is a coroutine method.";
+    params.set_status(STATUS_BAD_REQUEST);
+    params.Pack(msg);
+  }
+
+  virtual void Spawn(RpcMessage &params, const asio::any_io_executor &executor,
+                     std::function<void()> done) {
+    std::tuple<Args...> request;
+    if (!UnpackArgs(params, request)) {
+      PackUnpackError(params);
+      done();
+      return;
+    }
+    // The lambda is kept in the frame of the coroutine, and so is the
+    // request that the handler gets references to.
+    asio::co_spawn(executor,
+      [this, &params, request = std::move(request)]() mutable -> asio::awaitable<void> {
+      Response response = co_await std::apply(handle_, request);
+      params.Pack(response);
+    },
+      [this, &params, done = std::move(done)](std::exception_ptr e) {
+      if (e) {
+        std::string msg = "[" + func_name_ + "] has thrown";
+        try {
+          std::rethrow_exception(e);
+        }
+        catch (const std::exception &ex) {
+          msg = msg + ": " + ex.what();
+        }
+        catch (...) {}
+        params.set_status(STATUS_INTERNAL_ERROR);
+        params.Pack(msg);
+      }
+      done();
+    });
+  }
+
+private:
+  Handle handle_;
+};
+#endif
+
+// Server-streaming: the handler returns a generator, which is called
+// for each chunk only when the client has granted the credit for it.
+template<typename Chunk, typename... Args>
+class ServerStreamItem : public Item {
+public:
+  typedef std::function<bool(Chunk&)> Generator;
+
+  ServerStreamItem(std::string &func_name, 
+    typename _identity<std::function<Generator(Args&...)>>::type func) 
+    : handle_(func) {
+    func_name_ = func_name;
+    is_stream_ = true;
+  }
+
+  virtual void Apply(RpcMessage &params) {
+    std::string msg = "[" + func_name_ + "] is a streaming method.";
+    params.set_status(STATUS_BAD_REQUEST);
+    params.Pack(msg);
+  }
+
+  virtual Stream *Open(RpcMessage &params) {
+    std::tuple<Args...> request;
+    if (!UnpackArgs(params, request)) {
+      PackUnpackError(params);
+      return nullptr;
+    }
+    return new GeneratorStream(std::apply(handle_, request));
+  }
+
+private:
+  class GeneratorStream : public Stream {
+  public:
+    GeneratorStream(Generator generator) : generator_(generator) {
+      is_server_stream_ = true;
+    }
+    virtual bool Next(RpcMessage &message) {
+      Chunk chunk;
+      if (!generator_(chunk))
+        return false;
+      message.Pack(chunk);
+      return true;
+    }
+  private:
+    Generator generator_;
+  };
+
+private:
+  std::function<Generator(Args&...)> handle_;
+};
+
+// Client-streaming: the handler creates a sink for each call, which
+// takes in the chunks and then produces the response.
+template<typename Response, typename Chunk, typename... Args>
+class ClientStreamItem : public Item {
+public:
+  typedef std::unique_ptr<StreamSink<Chunk, Response>> Sink;
+
+  ClientStreamItem(std::string &func_name,
+    typename _identity<std::function<Sink(Args&...)>>::type func)
+    : handle_(func) {
+    func_name_ = func_name;
+    is_stream_ = true;
+  }
+
+  virtual void Apply(RpcMessage &params) {
+    std::string msg = "[" + func_name_ + "] is a streaming method.";
+    params.set_status(STATUS_BAD_REQUEST);
+    params.Pack(msg);
+  }
+
+  virtual Stream *Open(RpcMessage &params) {
+    std::tuple<Args...> request;
+    if (!UnpackArgs(params, request)) {
+      PackUnpackError(params);
+      return nullptr;
+    }
+    return new SinkStream(std::apply(handle_, request));
+  }
+
+private:
+  class SinkStream : public Stream {
+  public:
+    SinkStream(Sink sink) : sink_(std::move(sink)), is_failed_(false) {
+      is_server_stream_ = false;
+    }
+    virtual void Consume(RpcMessage &message) {
+      Chunk chunk;
+      message.Ready4Unpack();
+      message.GetArgs(chunk);
+      if (!message.buffer().good()) {
+        is_failed_ = true;
+        return;
+      }
+      sink_->OnChunk(chunk);
+    }
+    virtual void Finish(RpcMessage &message) {
+      if (is_failed_) {
+        std::string msg = "Failed to unpack a chunk of the stream.";
+        message.set_status(STATUS_BAD_REQUEST);
+        message.Pack(msg);
+        return;
+      }
+      Response response = sink_->OnFinish();
+      message.Pack(response);
+    }
+  private:
+    Sink sink_;
+    bool is_failed_;
+  };
+
+private:
+  std::function<Sink(Args&...)> handle_;
+};
+
 // Request & Response.
 class Processor {
+  // Slots of the dispatch table, which is an open addressing hash
+  // table with linear probing. Method ids are hashes already, so the
+  // low bits are used as the index directly.
+  struct Slot {
+    uint32_t method_id;
+    Item *item;
+  };
 
 public:
   Processor();
   ~Processor();
 
+  // The pool for the EXEC_POOL handlers, which is owned by the server.
+  inline void set_pool(ThreadPool *pool) { pool_ = pool; }
+  // Optional, it sheds the EXEC_POOL calls when the pool has a standing
+  // queue. Owned by the server.
+  inline void set_admission(AdmissionController *admission) { admission_ = admission; }
+  // Optional, the sessions compress the large responses to the clients
+  // that accept it. Owned by the server.
+  inline void set_compression(Compression *compression) { compression_ = compression; }
+  inline Compression *compression() const { return compression_; }
+  // The longest body of a request, the connection is closed on a longer one.
+  inline void set_max_body_length(uint64_t length) { max_body_length_ = length; }
+  inline uint64_t max_body_length() const { return max_body_length_; }
+
+  // Mark a method as idempotent with cache.is_idempotent, so that its
+  // responses are cached and the identical calls in flight are coalesced.
+  // If Response is asio::awaitable<T>, func is a coroutine that responds
+  // with a T, see CoroutineItem. It runs on the session's executor
+  // whatever the policy is.
   template<typename Response, typename... Args>
   void Bind(std::string func_name,
-    typename _identity<std::function<Response(Args&...)>>::type func) {
-    if (items_.find(func_name) != items_.end()) {
+    typename _identity<std::function<Response(Args&...)>>::type func,
+    ExecPolicy policy = EXEC_INLINE, const CacheOptions &cache = CacheOptions()) {
+    uint32_t method_id = MethodId(func_name);
+    Item *exist = Find(method_id);
+    if (exist != nullptr) {
+      printf("Duplicate: %s (conflicts with %s).", 
+        func_name.c_str(), exist->func_name().c_str());
+      return;
+    }
+    Item *item;
+#if defined(ASIO_HAS_CO_AWAIT)
+    if constexpr (IsAwaitable<Response>::value)
+      item = new CoroutineItem<typename Response::value_type, Args...>(func_name, func);
+    else
+#endif
+      item = new DerivedItem<Response, Args...>(func_name, func, policy);
+    if (cache.is_idempotent)
+      item->set_cache(std::make_shared<ResponseCache>(cache));
+    Insert(method_id, item);
+  }
+
+  // For the processors of the threads of a server to share one cache.
+  std::shared_ptr<ResponseCache> GetCache(const std::string &func_name) const;
+  void SetCache(const std::string &func_name, const std::shared_ptr<ResponseCache> &cache);
+
+  template<typename Chunk, typename... Args>
+  void BindServerStream(std::string func_name,
+    typename _identity<std::function<std::function<bool(Chunk&)>(Args&...)>>::type func) {
+    uint32_t method_id = MethodId(func_name);
+    if (Find(method_id) != nullptr) {
       printf("Duplicate: %s.", func_name.c_str());
       return;
     }
-    items_[func_name] = new DerivedItem<Response, Args...>(func_name, func);
+    Insert(method_id, new ServerStreamItem<Chunk, Args...>(func_name, func));
+  }
+
+  template<typename Response, typename Chunk, typename... Args>
+  void BindClientStream(std::string func_name,
+    typename _identity<std::function<std::unique_ptr<StreamSink<Chunk, Response>>(Args&...)>>::type func) {
+    uint32_t method_id = MethodId(func_name);
+    if (Find(method_id) != nullptr) {
+      printf("Duplicate: %s.", func_name.c_str());
+      return;
+    }
+    Insert(method_id, new ClientStreamItem<Response, Chunk, Args...>(func_name, func));
+  }
+
+  // Start a streaming call from its first frame. Returns nullptr with
+  // an error response packed into the message if it fails.
+  Stream *Open(RpcMessage &message);
+
+  // Returns true if the response has been packed into the message.
+  // Otherwise the handler has been offloaded to the worker pool, and
+  // done() will be called on a pool thread once the response is packed.
+  // A vectorized call (FLAG_MANY) of an EXEC_POOL method is run in one
+  // dispatch on the pool, with the argument sets spread over the pool.
+  // The response of an idempotent method may also come from its cache,
+  // or from an identical call in flight, which calls done() then.
+  // A request whose timeout has passed is answered with 
+  // STATUS_DEADLINE_EXCEEDED instead of running the handler, including
+  // the ones that expire while waiting in the queue of the pool.
+  // A coroutine method is spawned on the executor of the session, and
+  // done() is called there once it has returned.
+  template <typename Done>
+  bool Run(RpcMessage &message, const asio::any_io_executor &executor, Done &&done) {
+    Item *item = Find(message.method_id());
+    if (message.IsExpired(std::chrono::steady_clock::now())) {
+      Reject(item, message, STATUS_DEADLINE_EXCEEDED, "The deadline has passed before the call ran.");
+      return true;
+    }
+
+    ResponseCache *cache = (item != nullptr) ? item->cache().get() : nullptr;
+    std::string key;
+    if (cache != nullptr) {
+      key = ResponseCache::Key(message);
+      CacheResult result = cache->Lookup(key, &message, done);
+      Metrics::Instance().RecordCache(item->stats_index(), result);
+      if (result != CACHE_MISS)
+        return result == CACHE_HIT;
+    }
+
+    if (item != nullptr && item->is_coroutine() && !(message.flags() & FLAG_MANY)) {
+      Spawn(item, message, executor, [cache, key, &message, done]() {
+        if (cache != nullptr)
+          cache->Complete(key, message);
+        done();
+      });
+      return false;
+    }
+    if (item == nullptr || item->policy() == EXEC_INLINE || pool_ == nullptr) {
+      Apply(item, message);
+      if (cache != nullptr)
+        cache->Complete(key, message);
+      return true;
+    }
+    if (admission_ != nullptr && !admission_->TryAdmit()) {
+      Reject(item, message, STATUS_OVERLOADED, "The server is overloaded, the call is shed.");
+      if (cache != nullptr)
+        cache->Complete(key, message);
+      return true;
+    }
+
+    auto posted_at = std::chrono::steady_clock::now();
+    bool is_posted = pool_->TryPost(
+      [this, item, cache, key, posted_at, &message, done = std::forward<Done>(done)]() mutable {
+      auto now = std::chrono::steady_clock::now();
+      if (admission_ != nullptr) {
+        admission_->OnStart(std::chrono::duration_cast<std::chrono::nanoseconds>(
+          now - posted_at).count());
+      }
+      if (message.IsExpired(now))
+        Reject(item, message, STATUS_DEADLINE_EXCEEDED, "The deadline has passed in the queue.");
+      else
+        Apply(item, message);
+      if (cache != nullptr)
+        cache->Complete(key, message);
+      if (admission_ != nullptr)
+        admission_->OnFinish();
+      done();
+    });
+    if (!is_posted) {
+      if (admission_ != nullptr)
+        admission_->OnFinish();
+      Reject(item, message, STATUS_OVERLOADED, "The worker pool is full, the call is rejected.");
+      if (cache != nullptr)
+        cache->Complete(key, message);
+    }
+    return !is_posted;
+  }
+
+  // The names of all the bound methods, it is used for discovery.
+  std::vector<std::string> FuncNames() const;
+
+private:
+  inline Item *Find(uint32_t method_id) const {
+    if (table_.empty())
+      return nullptr;
+    size_t mask = table_.size() - 1;
+    for (size_t i = method_id & mask; ; i = (i + 1) & mask) {
+      if (table_[i].item == nullptr)
+        return nullptr;
+      if (table_[i].method_id == method_id)
+        return table_[i].item;
+    }
   }
 
-  void Run(RpcMessage &message);
+  void Insert(uint32_t method_id, Item *item);
+  void Apply(Item *item, RpcMessage &message);
+  void Spawn(Item *item, RpcMessage &message, const asio::any_io_executor &executor,
+             std::function<void()> done);
+  // Answer with an error without running the call.
+  void Reject(Item *item, RpcMessage &message, StatusCode status, const char *reason);
 
 private:
-  std::map<std::string, Item* > items_;
+  ThreadPool *pool_;
+  AdmissionController *admission_;
+  Compression *compression_;
+  uint64_t max_body_length_;
+  std::vector<Slot> table_;
+  size_t num_items_;
 };
 
 } // namespace mrpc
 
-#endif // MRPC_PROCESSOR_H_
\ No newline at end of file
+#endif // MRPC_PROCESSOR_H_
@@ -0,0 +1,75 @@
+#include "response_cache.h"
+
+namespace mrpc {
+
+std::string ResponseCache::Key(const RpcMessage &request) {
+  // The encoding and the shape of the call change the response.
+  std::string key(1, (char)(request.flags() & (FLAG_COMPACT | FLAG_MANY)));
+  key.append(request.body(), request.body_length());
+  return key;
+}
+
+void ResponseCache::CopyResponse(StatusCode status, const char *body, size_t length,
+                                 RpcMessage *message) {
+  message->set_status(status);
+  message->PackRaw(body, length);
+}
+
+CacheResult ResponseCache::Lookup(const std::string &key, RpcMessage *message,
+                                  std::function<void()> done) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto iter = entries_.find(key);
+  if (iter != entries_.end()) {
+    Entry &entry = *iter->second;
+    if (Clock::now() < entry.expires) {
+      lru_.splice(lru_.begin(), lru_, iter->second);
+      CopyResponse(entry.status, entry.body.data(), entry.body.size(), message);
+      return CACHE_HIT;
+    }
+    lru_.erase(iter->second);
+    entries_.erase(iter);
+  }
+
+  auto waiting = in_flight_.find(key);
+  if (waiting != in_flight_.end()) {
+    waiting->second.push_back(Waiter{ message, std::move(done) });
+    return CACHE_COALESCED;
+  }
+  in_flight_[key];
+  return CACHE_MISS;
+}
+
+void ResponseCache::Complete(const std::string &key, RpcMessage &response) {
+  std::vector<Waiter> waiters;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto waiting = in_flight_.find(key);
+    if (waiting != in_flight_.end()) {
+      waiters.swap(waiting->second);
+      in_flight_.erase(waiting);
+    }
+
+    if (response.status() == STATUS_OK && options_.capacity > 0) {
+      auto iter = entries_.find(key);
+      if (iter != entries_.end()) {
+        lru_.erase(iter->second);
+        entries_.erase(iter);
+      }
+      lru_.push_front(Entry{ key, STATUS_OK, std::string(response.body(), response.body_length()),
+                             Clock::now() + options_.ttl });
+      entries_[key] = lru_.begin();
+      while (lru_.size() > options_.capacity) {
+        entries_.erase(lru_.back().key);
+        lru_.pop_back();
+      }
+    }
+  }
+
+  // Out of the lock, done() posts the responses to their sessions.
+  for (auto &waiter : waiters) {
+    CopyResponse(response.status(), response.body(), response.body_length(), waiter.message);
+    waiter.done();
+  }
+}
+
+} // namespace mrpc
@@ -0,0 +1,79 @@
+#ifndef MRPC_RESPONSE_CACHE_H_
+#define MRPC_RESPONSE_CACHE_H_
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "message.h"
+#include "metrics.h"
+
+namespace mrpc {
+
+// For Bind(): a method marked idempotent gets its responses cached by
+// its arguments, and the identical calls in flight are run only once.
+struct CacheOptions {
+  bool is_idempotent = false;
+  // The maximum number of responses kept, the least recently used ones
+  // are evicted first.
+  size_t capacity = 1024;
+  // How long a response is served from the cache.
+  std::chrono::milliseconds ttl{1000};
+};
+
+// LRU cache of the responses of one method, keyed by the serialized
+// arguments (and the encoding) of the requests. Only the successful
+// responses are kept. A miss registers the call as in flight, and the
+// identical calls arriving until it completes wait for its response
+// instead of running the handler again, whether it succeeds or not.
+// Shared by the processors of all the threads of a server.
+class ResponseCache {
+  typedef std::chrono::steady_clock Clock;
+
+  struct Entry {
+    std::string key;
+    StatusCode status;
+    std::string body;
+    Clock::time_point expires;
+  };
+
+  // A coalesced call waiting for the response of the one in flight.
+  struct Waiter {
+    RpcMessage *message;
+    std::function<void()> done;
+  };
+
+public:
+  ResponseCache(const CacheOptions &options) : options_(options) {}
+
+  // Taken from a request before it is unpacked.
+  static std::string Key(const RpcMessage &request);
+
+  // CACHE_HIT: the response has been copied into the message.
+  // CACHE_MISS: run the call, and then Complete() it with the same key.
+  // CACHE_COALESCED: an identical call is in flight, done() will be called
+  // once its response has been copied into the message.
+  CacheResult Lookup(const std::string &key, RpcMessage *message, std::function<void()> done);
+  // Answer the calls coalesced into this one, and cache the response.
+  void Complete(const std::string &key, RpcMessage &response);
+
+private:
+  static void CopyResponse(StatusCode status, const char *body, size_t length, RpcMessage *message);
+
+private:
+  CacheOptions options_;
+
+  std::mutex mutex_;
+  // The most recently used at the front.
+  std::list<Entry> lru_;
+  std::unordered_map<std::string, std::list<Entry>::iterator> entries_;
+  std::unordered_map<std::string, std::vector<Waiter>> in_flight_;
+};
+
+} // namespace mrpc
+
+#endif // MRPC_RESPONSE_CACHE_H_
@@ -1,49 +1,305 @@
 #ifndef MRPC_SERIALIZER_H_
 #define MRPC_SERIALIZER_H_
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <tuple>
+#include <vector>
+#include "buffer.h"
 
 namespace mrpc {
 
+// Read-only view of a contiguous array, like std::span in c++20.
+// Used as a handler parameter, it points into the receive buffer of
+// the request instead of being copied out of it, so it is only valid
+// until the handler returns. std::string_view works the same way.
+// It is serialized in the same format as std::vector<T>. Views of
+// integer arrays are not available in the compact mode, as their
+// elements are varints then.
+template <typename T>
+class ArrayView {
+public:
+  ArrayView() : data_(nullptr), size_(0) {}
+  ArrayView(const T *data, size_t size) : data_(data), size_(size) {}
+  ArrayView(const std::vector<T> &vec) : data_(vec.data()), size_(vec.size()) {}
+
+  inline const T *data() const { return data_; }
+  inline size_t size() const { return size_; }
+  inline bool empty() const { return size_ == 0; }
+
+  inline const T *begin() const { return data_; }
+  inline const T *end() const { return data_ + size_; }
+  inline const T &operator[](size_t i) const { return data_[i]; }
+
+private:
+  const T *data_;
+  size_t size_;
+};
+
+template <class T> struct IsTuple : std::false_type {};
+template <class... Ts> struct IsTuple<std::tuple<Ts...>> : std::true_type {};
+
+template <class T> struct IsView : std::false_type {};
+template <> struct IsView<std::string_view> : std::true_type {};
+template <class T> struct IsView<ArrayView<T>> : std::true_type {};
+
 class Serializer {
 public:
+  // The types of the fields of a HANDYPACK struct.
+  template <class... Ts> struct TypeList {};
+  // Only for decltype in HANDYPACK.
+  template <class... Ts> static TypeList<Ts...> TypesOf(const Ts&...);
+
+  // The serialized size of every T in the default encoding, if it is
+  // the same for all of them, eg. the arithmetic types and the HANDYPACK
+  // structs made of them. 0 if it varies. It is known at compile time.
+  template<class T, typename E = void>
+  struct FixedSize {
+    static constexpr size_t value = 0;
+  };
+  // All of the types are fixed-size, or 0.
+  template <class... Ts>
+  static constexpr size_t FixedSizeOf(TypeList<Ts...>) {
+    return ((FixedSize<Ts>::value > 0) && ...) ? (FixedSize<Ts>::value + ... + 0) : 0;
+  }
+
+  template<class T, typename E = void>
+  struct HasFields : std::false_type {};
+  template<class T>
+  struct HasFields<T, std::void_t<typename T::HandyTypes>> : std::true_type {};
+
+  // The fixed-size values copied directly to or from p, which has room
+  // for them, in the same layout as Dump() in the default encoding.
+  // Returns the end. The others are never passed, they are skipped.
+  static inline char *DumpFixed(char *p) { return p; }
+  template <class T, class... Args>
+  static inline char *DumpFixed(char *p, const T& first, const Args&... args) {
+    if constexpr (FixedSize<T>::value == 0) {
+      return p;
+    }
+    else if constexpr (HasFields<T>::value) {
+      p = first.T::DumpFields(p);
+    }
+    else if constexpr (IsTuple<T>::value) {
+      p = std::apply([p](const auto&... elems) { return DumpFixed(p, elems...); }, first);
+    }
+    else if constexpr (std::is_trivially_copyable<T>::value) {
+      memcpy(p, &first, sizeof(T));
+      p += sizeof(T);
+    }
+    else {
+      for (const auto& obj : first)
+        p = DumpFixed(p, obj);
+    }
+    return DumpFixed(p, args...);
+  }
+
+  static inline const char *LoadFixed(const char *p) { return p; }
+  template <class T, class... Args>
+  static inline const char *LoadFixed(const char *p, T& first, Args&... args) {
+    if constexpr (FixedSize<T>::value == 0) {
+      return p;
+    }
+    else if constexpr (HasFields<T>::value) {
+      p = first.T::LoadFields(p);
+    }
+    else if constexpr (IsTuple<T>::value) {
+      p = std::apply([p](auto&... elems) { return LoadFixed(p, elems...); }, first);
+    }
+    else if constexpr (std::is_trivially_copyable<T>::value) {
+      memcpy(&first, p, sizeof(T));
+      p += sizeof(T);
+    }
+    else {
+      for (auto& obj : first)
+        p = LoadFixed(p, obj);
+    }
+    return LoadFixed(p, args...);
+  }
+
+  // The types with their own Dump() and Load().
   template<class T, typename E = void>
   class Base {
   public:
-    static inline void Dump(std::ostream& out, const T& object) {
+    static inline void Dump(Buffer& out, const T& object) {
       object.Dump(out);
     }
-    static inline void Load(std::istream& in, T& object) {
+    static inline void Load(Buffer& in, T& object) {
       object.Load(in);
     }
+    // Unknown in advance, the buffer will grow on demand.
+    static inline size_t Size(const Buffer& out, const T& object) { return 0; }
+  };
+
+  // The structs with HANDYPACK. The generated functions are called
+  // through the static type, so they are inlined instead of being
+  // virtual calls. A fixed-layout struct is one block of a constant
+  // size in the default encoding, which its fields are copied into or
+  // out of directly.
+  template <class T>
+  class ForFields {
+    static const size_t FIXED_SIZE = FixedSize<T>::value;
+
+  public:
+    static inline void Dump(Buffer& out, const T& object) {
+      if constexpr (FIXED_SIZE > 0) {
+        if (!out.is_compact()) {
+          out.Reserve(FIXED_SIZE);
+          object.T::DumpFields(out.tail());
+          out.Commit(FIXED_SIZE);
+          return;
+        }
+      }
+      object.T::Dump(out);
+    }
+    static inline void Load(Buffer& in, T& object) {
+      if constexpr (FIXED_SIZE > 0) {
+        if (!in.is_compact()) {
+          const char *p = in.Consume(FIXED_SIZE);
+          if (p != nullptr)
+            object.T::LoadFields(p);
+          return;
+        }
+      }
+      object.T::Load(in);
+    }
+    static inline size_t Size(const Buffer& out, const T& object) {
+      if constexpr (FIXED_SIZE > 0) {
+        if (!out.is_compact())
+          return FIXED_SIZE;
+      }
+      return object.T::FieldsSize(out);
+    }
   };
 
   template <class T>
   class ForPod {
   public:
-    static inline void Dump(std::ostream& out, const T& object) {
-      out.write((const char*)(&object), sizeof(T));
+    static inline void Dump(Buffer& out, const T& object) {
+      out.Write(&object, sizeof(T));
     }
-    static inline void Load(std::istream& in, T& object) {
-      in.read((char*)(&object), sizeof(T));
+    static inline void Load(Buffer& in, T& object) {
+      in.Read(&object, sizeof(T));
+    }
+    static inline size_t Size(const Buffer& out, const T& object) { return sizeof(T); }
+  };
+
+  // The compact encoding of integers, used when the buffer is in the
+  // compact mode: LEB128 varints, with zigzag for the signed ones, so
+  // that small values take one or two bytes instead of sizeof(T).
+  class Varint {
+  public:
+    static inline void Write(Buffer& out, uint64_t value) {
+      out.Reserve(MAX_BYTES);
+      uint8_t *p = (uint8_t *)out.tail();
+      size_t n = 0;
+      while (value >= 0x80) {
+        p[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+      }
+      p[n++] = (uint8_t)value;
+      out.Commit(n);
+    }
+
+    static inline uint64_t Read(Buffer& in) {
+      const uint8_t *p = (const uint8_t *)in.data() + in.read_pos();
+      size_t limit = std::min(in.remaining(), MAX_BYTES);
+      uint64_t value = 0;
+      for (size_t n = 0; n < limit; n++) {
+        value |= (uint64_t)(p[n] & 0x7F) << (7 * n);
+        if ((p[n] & 0x80) == 0) {
+          in.Consume(n + 1);
+          return value;
+        }
+      }
+      in.Fail();
+      return 0;
+    }
+
+    static inline uint64_t ZigZag(int64_t value) {
+      return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+    }
+    static inline int64_t UnZigZag(uint64_t value) {
+      return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    // The most bytes an integer of n bytes takes.
+    static constexpr size_t MaxBytes(size_t n) { return (n * 8 + 6) / 7; }
+
+  private:
+    constexpr static size_t MAX_BYTES = 10;
+  };
+
+  // The length prefix of containers.
+  static inline void DumpLength(Buffer& out, uint32_t size) {
+    if (out.is_compact())
+      Varint::Write(out, size);
+    else
+      out.Write(&size, sizeof(size));
+  }
+  static inline uint32_t LoadLength(Buffer& in) {
+    uint32_t size;
+    if (in.is_compact())
+      size = (uint32_t)Varint::Read(in);
+    else
+      in.Read(&size, sizeof(size));
+    return size;
+  }
+  static inline size_t LengthSize(const Buffer& out) {
+    return out.is_compact() ? Varint::MaxBytes(sizeof(uint32_t)) : sizeof(uint32_t);
+  }
+
+  // Integers are fixed-width in the default mode and varints in the compact one.
+  template <class T>
+  class ForInteger {
+  public:
+    static inline void Dump(Buffer& out, const T& object) {
+      if (sizeof(T) == 1 || !out.is_compact())
+        out.Write(&object, sizeof(T));
+      else if (std::is_signed<T>::value)
+        Varint::Write(out, Varint::ZigZag((int64_t)object));
+      else
+        Varint::Write(out, (uint64_t)object);
+    }
+    static inline void Load(Buffer& in, T& object) {
+      if (sizeof(T) == 1 || !in.is_compact())
+        in.Read(&object, sizeof(T));
+      else if (std::is_signed<T>::value)
+        object = (T)Varint::UnZigZag(Varint::Read(in));
+      else
+        object = (T)Varint::Read(in);
+    }
+    static inline size_t Size(const Buffer& out, const T& object) {
+      return (sizeof(T) == 1 || !out.is_compact()) ? sizeof(T) : Varint::MaxBytes(sizeof(T));
     }
   };
 
   template<class TVec, class TObj>
   class ForVector {
   public:
-    static inline void Dump(std::ostream& out, const TVec& object) {
-      uint32_t size = object.size();
-      out.write((const char*)(&size), sizeof(size));
+    static inline void Dump(Buffer& out, const TVec& object) {
+      if constexpr (FixedSize<TObj>::value > 0) {
+        if (!out.is_compact())
+          out.Reserve(sizeof(uint32_t) + object.size() * FixedSize<TObj>::value);
+      }
+      DumpLength(out, object.size());
       for (const auto& obj : object) {
         Serializer::Dump(out, obj);
       }
     }
 
-    static inline void Load(std::istream& in, TVec& object) {
-      uint32_t size;
-      in.read((char*)(&size), sizeof(size));
+    static inline void Load(Buffer& in, TVec& object) {
+      uint32_t size = LoadLength(in);
       object.clear();
+      // Do not trust the size blindly, each element takes at least one byte.
+      if (size > in.remaining()) {
+        in.Fail();
+        return;
+      }
       object.reserve(size);
       for (size_t i = 0; i < size; ++i) {
         TObj obj;
@@ -51,42 +307,288 @@ public:
         object.push_back(std::move(obj));
       }
     }
+
+    static inline size_t Size(const Buffer& out, const TVec& object) {
+      if constexpr (FixedSize<TObj>::value > 0) {
+        if (!out.is_compact())
+          return sizeof(uint32_t) + object.size() * FixedSize<TObj>::value;
+      }
+      size_t size = LengthSize(out);
+      for (const auto& obj : object) {
+        size += Serializer::Size(out, obj);
+      }
+      return size;
+    }
+  };
+
+  // For the contiguous containers of trivially copyable elements,
+  // the elements are copied as one block instead of one by one.
+  // The block is padded to the alignment of the element within the
+  // message, so that it can also be loaded as a view in place.
+  // In the compact mode, the elements of integer containers are 
+  // encoded one by one as varints instead.
+  template<class TVec, class TObj>
+  class ForBlockVector {
+    static_assert(alignof(TObj) <= 16, "The padding only supports alignments up to 16 bytes.");
+    static const bool IS_VARINT = std::is_integral<TObj>::value && sizeof(TObj) > 1;
+
+  public:
+    static inline void Dump(Buffer& out, const TVec& object) {
+      uint32_t size = object.size();
+      if constexpr (IS_VARINT) {
+        if (out.is_compact()) {
+          DumpLength(out, size);
+          for (size_t i = 0; i < size; i++)
+            ForInteger<TObj>::Dump(out, object.data()[i]);
+          return;
+        }
+      }
+      out.Reserve(sizeof(size) + alignof(TObj) - 1 + size * sizeof(TObj));
+      DumpLength(out, size);
+      size_t padding = Padding(out.size());
+      if (padding > 0) {
+        uint64_t zeros[2] = { 0, 0 };
+        out.Write(zeros, padding);
+      }
+      out.Write(object.data(), size * sizeof(TObj));
+    }
+
+    static inline void Load(Buffer& in, TVec& object) {
+      object.clear();
+      if constexpr (IS_VARINT) {
+        if (in.is_compact()) {
+          uint32_t size = LoadLength(in);
+          // Each element takes at least one byte.
+          if (size > in.remaining()) {
+            in.Fail();
+            return;
+          }
+          object.resize(size);
+          for (size_t i = 0; i < size; i++)
+            ForInteger<TObj>::Load(in, object[i]);
+          return;
+        }
+      }
+      uint32_t size;
+      const char *p = LoadBlock(in, &size);
+      if (p != nullptr && size > 0) {
+        object.resize(size);
+        memcpy(&object[0], p, size * sizeof(TObj));
+      }
+    }
+
+    static inline size_t Size(const Buffer& out, const TVec& object) {
+      if (IS_VARINT && out.is_compact())
+        return LengthSize(out) + object.size() * Varint::MaxBytes(sizeof(TObj));
+      return LengthSize(out) + alignof(TObj) - 1 + object.size() * sizeof(TObj);
+    }
+
+    // Returns the address of the elements in the buffer, 
+    // or nullptr if the buffer is malformed.
+    // Integer blocks are not in place in the compact mode.
+    static inline const char *LoadBlock(Buffer& in, uint32_t *size) {
+      *size = 0;
+      if (IS_VARINT && in.is_compact()) {
+        in.Fail();
+        return nullptr;
+      }
+      *size = LoadLength(in);
+      if (in.Consume(Padding(in.read_pos())) == nullptr) {
+        *size = 0;
+        return nullptr;
+      }
+      const char *p = in.Consume((uint64_t)(*size) * sizeof(TObj));
+      if (p == nullptr)
+        *size = 0;
+      return p;
+    }
+
+  private:
+    static inline size_t Padding(size_t offset) {
+      return (alignof(TObj) - offset % alignof(TObj)) % alignof(TObj);
+    }
+  };
+
+  // Views of strings and arrays, only for loading in place.
+  template<class TView, class TObj>
+  class ForView {
+  public:
+    static inline void Dump(Buffer& out, const TView& object) {
+      ForBlockVector<TView, TObj>::Dump(out, object);
+    }
+    static inline void Load(Buffer& in, TView& object) {
+      uint32_t size;
+      const char *p = ForBlockVector<TView, TObj>::LoadBlock(in, &size);
+      object = (p == nullptr) ? TView() : TView((const TObj *)p, size);
+    }
+    static inline size_t Size(const Buffer& out, const TView& object) {
+      return ForBlockVector<TView, TObj>::Size(out, object);
+    }
+  };
+
+  // Fixed-length arrays with the elements handled one by one,
+  // std::array<T, N> and T[N] of non-trivially copyable T.
+  template<class TArr>
+  class ForArray {
+  public:
+    static inline void Dump(Buffer& out, const TArr& object) {
+      for (const auto& obj : object) {
+        Serializer::Dump(out, obj);
+      }
+    }
+    static inline void Load(Buffer& in, TArr& object) {
+      for (auto& obj : object) {
+        Serializer::Load(in, obj);
+      }
+    }
+    static inline size_t Size(const Buffer& out, const TArr& object) {
+      if constexpr (FixedSize<TArr>::value > 0) {
+        if (!out.is_compact())
+          return FixedSize<TArr>::value;
+      }
+      size_t size = 0;
+      for (const auto& obj : object) {
+        size += Serializer::Size(out, obj);
+      }
+      return size;
+    }
+  };
+
+  template<class T>
+  struct IsBlockCopyable {
+    // The layout of a tuple is up to the standard library, it is never a block.
+    static const bool value = std::is_trivially_copyable<T>::value && !std::is_same<T, bool>::value
+                              && !IsTuple<T>::value;
+  };
+
+  // The elements one by one, eg. the argument sets of Client::CallMany().
+  template<class TTuple>
+  class ForTuple {
+  public:
+    static inline void Dump(Buffer& out, const TTuple& object) {
+      std::apply([&out](const auto&... elems) { Serializer::Dump(out, elems...); }, object);
+    }
+    static inline void Load(Buffer& in, TTuple& object) {
+      std::apply([&in](auto&... elems) { Serializer::Load(in, elems...); }, object);
+    }
+    static inline size_t Size(const Buffer& out, const TTuple& object) {
+      return std::apply([&out](const auto&... elems) { return Serializer::Size(out, elems...); }, object);
+    }
   };
 
 public:
+  static inline void Dump(Buffer& out) {}
   template <class T>
-  static inline void Dump(std::ostream& out, const T& t) {
+  static inline void Dump(Buffer& out, const T& t) {
     Base<T>::Dump(out, t);
   }
   template<class T, class... Args>
-  static inline void Dump(std::ostream& out, const T& first, const Args&... args) {
+  static inline void Dump(Buffer& out, const T& first, const Args&... args) {
     Dump(out, first);
     Dump(out, args...);
   }
 
+  static inline void Load(Buffer& in) {}
   template <class T>
-  static inline void Load(std::istream& in, T& t) {
+  static inline void Load(Buffer& in, T& t) {
     Base<T>::Load(in, t);
   }
   template <class T, class... Args>
-  static inline void Load(std::istream& in, T& first, Args&... args) {
+  static inline void Load(Buffer& in, T& first, Args&... args) {
     Load(in, first);
     Load(in, args...);
   }
+
+  // The number of bytes Dump() is going to write into out, used to
+  // reserve the buffer ahead so that it is allocated once. It is exact
+  // in the default encoding except for the padding of the blocks, and
+  // an upper bound in the compact one. It is 0 for the types with their
+  // own Dump() whose size is unknown, they grow the buffer on demand.
+  // A fixed-size type takes no traversal, see FixedSize.
+  static inline size_t Size(const Buffer& out) { return 0; }
+  template <class T, class... Args>
+  static inline size_t Size(const Buffer& out, const T& first, const Args&... args) {
+    return Base<T>::Size(out, first) + Size(out, args...);
+  }
 };
 
 template<class T>
-class Serializer::Base<T, typename std::enable_if<!std::is_class<T>::value>::type> : public Serializer::ForPod<T> {};
-template <> class Serializer::Base<std::string> : public Serializer::ForVector<std::string, char> {};
+struct Serializer::FixedSize<T, typename std::enable_if<!std::is_class<T>::value && !std::is_array<T>::value>::type> {
+  static constexpr size_t value = sizeof(T);
+};
+template<class T>
+struct Serializer::FixedSize<T, std::void_t<typename T::HandyTypes>> {
+  static constexpr size_t value = Serializer::FixedSizeOf(typename T::HandyTypes());
+};
+template <class... Ts>
+struct Serializer::FixedSize<std::tuple<Ts...>> {
+  static constexpr size_t value = Serializer::FixedSizeOf(Serializer::TypeList<Ts...>());
+};
+template <class T, size_t N>
+struct Serializer::FixedSize<std::array<T, N>> {
+  static constexpr size_t value = Serializer::IsBlockCopyable<T>::value ? sizeof(std::array<T, N>)
+                                                                       : N * FixedSize<T>::value;
+};
+template <class T, size_t N>
+struct Serializer::FixedSize<T[N]> {
+  static constexpr size_t value = Serializer::IsBlockCopyable<T>::value ? sizeof(T[N])
+                                                                       : N * FixedSize<T>::value;
+};
+
+template<class T>
+class Serializer::Base<T, typename std::enable_if<!std::is_class<T>::value && !std::is_array<T>::value
+  && !std::is_integral<T>::value>::type> : public Serializer::ForPod<T> {};
+template<class T>
+class Serializer::Base<T, std::void_t<typename T::HandyTypes>> : public Serializer::ForFields<T> {};
+template<class T>
+class Serializer::Base<T, typename std::enable_if<std::is_integral<T>::value>::type> : public Serializer::ForInteger<T> {};
+template <> class Serializer::Base<std::string> : public Serializer::ForBlockVector<std::string, char> {};
+template <> class Serializer::Base<std::string_view> : public Serializer::ForView<std::string_view, char> {};
+template <class T>
+class Serializer::Base<ArrayView<T>> : public Serializer::ForView<ArrayView<T>, T> {
+  static_assert(Serializer::IsBlockCopyable<T>::value, "ArrayView only supports trivially copyable elements.");
+};
+
+template <class... Ts>
+class Serializer::Base<std::tuple<Ts...>> : public Serializer::ForTuple<std::tuple<Ts...>> {};
+
+template <class T> 
+class Serializer::Base<std::vector<T>> : public std::conditional<Serializer::IsBlockCopyable<T>::value,
+  Serializer::ForBlockVector<std::vector<T>, T>, Serializer::ForVector<std::vector<T>, T>>::type {};
 
+// Fixed-length arrays have no length prefix, and the trivially copyable ones are a single block.
+template <class T, size_t N>
+class Serializer::Base<std::array<T, N>> : public std::conditional<Serializer::IsBlockCopyable<T>::value,
+  Serializer::ForPod<std::array<T, N>>, Serializer::ForArray<std::array<T, N>>>::type {};
+template <class T, size_t N>
+class Serializer::Base<T[N]> : public std::conditional<Serializer::IsBlockCopyable<T>::value,
+  Serializer::ForPod<T[N]>, Serializer::ForArray<T[N]>>::type {};
+
+// The serializer of a struct by its fields. Besides Dump() and Load(),
+// it generates the size pass: FieldsSize() traverses the fields once,
+// and HandyTypes gives the constant size of a fixed-layout struct, see
+// Serializer::FixedSize. DumpFields() and LoadFields() copy the fields
+// of a fixed-layout struct as one block, see Serializer::ForFields.
 #define HANDYPACK(...)                                  \
-  inline virtual void Dump(std::ostream& out) const {   \
-    Serializer::Dump(out, __VA_ARGS__);                 \
+  typedef decltype(mrpc::Serializer::TypesOf(__VA_ARGS__)) HandyTypes; \
+                                                        \
+  inline virtual void Dump(mrpc::Buffer& out) const {   \
+    mrpc::Serializer::Dump(out, __VA_ARGS__);           \
   }                                                     \
                                                         \
-  inline virtual void Load(std::istream& in) {          \
-    Serializer::Load(in, __VA_ARGS__);                  \
+  inline virtual void Load(mrpc::Buffer& in) {          \
+    mrpc::Serializer::Load(in, __VA_ARGS__);            \
+  }                                                     \
+                                                        \
+  inline size_t FieldsSize(const mrpc::Buffer& out) const { \
+    return mrpc::Serializer::Size(out, __VA_ARGS__);    \
+  }                                                     \
+  inline char *DumpFields(char *p) const {              \
+    return mrpc::Serializer::DumpFixed(p, __VA_ARGS__); \
+  }                                                     \
+  inline const char *LoadFields(const char *p) {        \
+    return mrpc::Serializer::LoadFixed(p, __VA_ARGS__); \
   }
 
 } // namespace mrpc
-#endif // MRPC_SERIALIZER_H_
\ No newline at end of file
+#endif // MRPC_SERIALIZER_H_
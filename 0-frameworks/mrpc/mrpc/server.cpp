@@ -0,0 +1,211 @@
+#include "server.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+namespace mrpc {
+
+Server::Server(asio::io_context& io_context, short port) : next_worker_(0) {
+  workers_.emplace_back(new Worker);
+  workers_[0]->io_context = &io_context;
+  SetSessionPool(DEFAULT_IDLE_SESSIONS);
+
+  acceptor_.reset(new asio::ip::tcp::acceptor(io_context,
+    asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)));
+  do_accept();
+}
+
+Server::Server(short port, int num_threads) : next_worker_(0) {
+  if (num_threads <= 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (int i = 0; i < num_threads; i++) {
+    io_contexts_.emplace_back(new asio::io_context(1));
+    workers_.emplace_back(new Worker);
+    workers_[i]->io_context = io_contexts_[i].get();
+  }
+  SetSessionPool(DEFAULT_IDLE_SESSIONS);
+
+  acceptor_.reset(new asio::ip::tcp::acceptor(*io_contexts_[0],
+    asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)));
+  do_accept();
+}
+
+Server::~Server() {
+  Stop();
+}
+
+void Server::SetWorkerPool(int num_threads, size_t max_queue_depth) {
+  pool_.reset(new ThreadPool(num_threads, max_queue_depth));
+  for (auto &worker : workers_) {
+    worker->proc.set_pool(pool_.get());
+  }
+}
+
+void Server::SetAdmissionControl(const AdmissionOptions &options) {
+  AdmissionOptions adjusted = options;
+  // Keep the pool busy however low the limit goes.
+  if (pool_ != nullptr)
+    adjusted.min_limit = std::max(adjusted.min_limit, pool_->num_threads());
+  admission_.reset(new AdmissionController(adjusted));
+  for (auto &worker : workers_) {
+    worker->proc.set_admission(admission_.get());
+  }
+}
+
+void Server::SetCompression(const CompressionOptions &options) {
+  compression_.reset(new Compression(options));
+  for (auto &worker : workers_) {
+    worker->proc.set_compression(compression_.get());
+  }
+}
+
+void Server::SetMaxBodyLength(uint64_t length) {
+  for (auto &worker : workers_) {
+    worker->proc.set_max_body_length(length);
+  }
+}
+
+CompressionStats Server::compression_stats() const {
+  if (compression_ == nullptr)
+    return CompressionStats();
+  return compression_->stats();
+}
+
+void Server::SetSessionPool(size_t max_idle) {
+  for (auto &worker : workers_) {
+    if (worker->sessions == nullptr)
+      worker->sessions = std::make_shared<SessionPool>(&worker->proc, max_idle);
+    else
+      worker->sessions->set_max_idle(max_idle);
+  }
+}
+
+size_t Server::num_sessions_created() const {
+  size_t n = 0;
+  for (auto &worker : workers_)
+    n += worker->sessions->num_created();
+  return n;
+}
+
+size_t Server::num_sessions_reused() const {
+  size_t n = 0;
+  for (auto &worker : workers_)
+    n += worker->sessions->num_reused();
+  return n;
+}
+
+void Server::Run() {
+  if (io_contexts_.empty() || !threads_.empty())
+    return;
+
+  auto entry = [this](size_t i) {
+#ifdef __linux__
+    unsigned int num_cores = std::thread::hardware_concurrency();
+    if (num_cores > 1) {
+      cpu_set_t cpuset;
+      CPU_ZERO(&cpuset);
+      CPU_SET(i % num_cores, &cpuset);
+      pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    }
+#endif
+    auto work = asio::make_work_guard(*io_contexts_[i]);
+    io_contexts_[i]->run();
+  };
+
+  for (size_t i = 1; i < io_contexts_.size(); i++) {
+    threads_.emplace_back(entry, i);
+  }
+  entry(0);
+
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+  threads_.clear();
+}
+
+void Server::Stop() {
+  for (auto &io_context : io_contexts_) {
+    io_context->stop();
+  }
+}
+
+Server::Worker *Server::NextWorker() {
+  Worker *worker = workers_[next_worker_].get();
+  next_worker_ = (next_worker_ + 1) % workers_.size();
+  return worker;
+}
+
+void Server::StartSession(Worker *worker, std::unique_ptr<Transport> transport) {
+  auto executor = transport->get_executor();
+  asio::post(executor, [worker, transport = std::move(transport)]() mutable {
+    worker->sessions->Acquire(std::move(transport))->start();
+  });
+}
+
+void Server::do_accept() {
+  // Accept into a strand of the io_context of the next worker directly, 
+  // then the session only runs on the thread of that worker.
+  Worker *worker = NextWorker();
+  acceptor_->async_accept(asio::make_strand(*worker->io_context),
+    [this, worker](std::error_code ec, asio::ip::tcp::socket socket) {
+    if (!ec) {
+      // Small responses should not wait for the acks of the previous ones.
+      asio::error_code option_ec;
+      socket.set_option(asio::ip::tcp::no_delay(true), option_ec);
+      StartSession(worker, std::unique_ptr<Transport>(new TcpTransport(std::move(socket))));
+    }
+    do_accept();
+  });
+}
+
+#ifndef _WIN32
+void Server::ListenLocal(const std::string &path) {
+  ::unlink(path.c_str());
+  local_acceptor_.reset(new asio::local::stream_protocol::acceptor(
+    *workers_[0]->io_context, asio::local::stream_protocol::endpoint(path)));
+  do_accept_local();
+}
+
+void Server::do_accept_local() {
+  Worker *worker = NextWorker();
+  local_acceptor_->async_accept(asio::make_strand(*worker->io_context),
+    [this, worker](std::error_code ec, asio::local::stream_protocol::socket socket) {
+    if (!ec)
+      StartSession(worker, std::unique_ptr<Transport>(new LocalTransport(std::move(socket))));
+    do_accept_local();
+  });
+}
+#endif // _WIN32
+
+#ifdef __linux__
+void Server::ListenShm(const std::string &path, size_t ring_size) {
+  ::unlink(path.c_str());
+  shm_ring_size_ = ring_size;
+  shm_acceptor_.reset(new asio::local::stream_protocol::acceptor(
+    *workers_[0]->io_context, asio::local::stream_protocol::endpoint(path)));
+  do_accept_shm();
+}
+
+void Server::do_accept_shm() {
+  Worker *worker = NextWorker();
+  shm_acceptor_->async_accept(asio::make_strand(*worker->io_context),
+    [this, worker](std::error_code ec, asio::local::stream_protocol::socket socket) {
+    if (!ec) {
+      try {
+        StartSession(worker, ShmTransport::Accept(std::move(socket), shm_ring_size_));
+      }
+      catch (std::system_error &e) {
+        std::cerr << "Failed to set up the shared memory: " << e.what() << std::endl;
+      }
+    }
+    do_accept_shm();
+  });
+}
+#endif // __linux__
+
+} // namespace mrpc
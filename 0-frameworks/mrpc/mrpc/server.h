@@ -1,41 +1,166 @@
 #ifndef MRPC_SERVER_H_
 #define MRPC_SERVER_H_
 
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
 #include "asio.hpp"
 #include "session.h"
+#include "shm_transport.h"
 
 namespace mrpc {
 
+// Two modes:
+// 1. Server(io_context, port): all the sessions run on the given 
+//    io_context, which is run by the caller.
+// 2. Server(port, num_threads): the server owns num_threads io_contexts,
+//    each of them is run by its own thread (pinned to a core on linux).
+//    Accepted connections are distributed round-robin among them, and
+//    a session stays on one thread for its whole life.
+//
+// Each thread has its own Processor, and Bind() gives each of them a
+// copy of the function. So the state captured by a handler is per 
+// thread, and it can be used without locking. Bind all the functions
+// before running the server.
+//
+// Besides the TCP port, the same functions can be served to the processes
+// on the same host through a unix domain socket or a shared-memory ring,
+// see ListenLocal() and ListenShm().
 class Server {
+  const static size_t DEFAULT_QUEUE_DEPTH = 1024;
+  const static size_t DEFAULT_IDLE_SESSIONS = 64;
+
+  struct Worker {
+    asio::io_context *io_context;
+    Processor proc;
+    std::shared_ptr<SessionPool> sessions;
+  };
+
 public:
-  Server(asio::io_context& io_context, short port)
-    : acceptor_(io_context, asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port)) {
-    do_accept();
-  }
+  Server(asio::io_context& io_context, short port);
+  Server(short port, int num_threads);
+  ~Server();
 
+  // policy: EXEC_INLINE for the cheap handlers, or EXEC_POOL for the
+  // slow ones, which are run by the worker pool shared by all the threads.
+  // cache: see CacheOptions, one cache is shared by all the threads.
   template<typename Response, typename... Args>
   inline void Bind(std::string func_name,
-      typename _identity<std::function<Response(Args&...)>>::type func) {
-    proc_.Bind<Response, Args...>(func_name, func);
+      typename _identity<std::function<Response(Args&...)>>::type func,
+      ExecPolicy policy = EXEC_INLINE, const CacheOptions &cache = CacheOptions()) {
+    if (policy == EXEC_POOL && pool_ == nullptr)
+      SetWorkerPool(std::max(1u, std::thread::hardware_concurrency()), DEFAULT_QUEUE_DEPTH);
+    for (auto &worker : workers_) {
+      worker->proc.Bind<Response, Args...>(func_name, func, policy, cache);
+      if (cache.is_idempotent)
+        worker->proc.SetCache(func_name, workers_[0]->proc.GetCache(func_name));
+    }
   }
 
-private:
-  inline void do_accept() {
-    acceptor_.async_accept(
-      [this](std::error_code ec, asio::ip::tcp::socket socket) {
-      if (!ec) {
-        std::make_shared<Session>(std::move(socket), &proc_)->start();
-      }
-      do_accept();
-    });
+  // Streaming methods, they always run inline on the session's thread.
+  // Server-streaming: func returns a generator, which fills the next
+  // chunk and returns false at the end of the stream.
+  template<typename Chunk, typename... Args>
+  inline void BindServerStream(std::string func_name,
+      typename _identity<std::function<std::function<bool(Chunk&)>(Args&...)>>::type func) {
+    for (auto &worker : workers_) {
+      worker->proc.BindServerStream<Chunk, Args...>(func_name, func);
+    }
   }
 
+  // Client-streaming: func creates a sink for each call.
+  template<typename Response, typename Chunk, typename... Args>
+  inline void BindClientStream(std::string func_name,
+      typename _identity<std::function<std::unique_ptr<StreamSink<Chunk, Response>>(Args&...)>>::type func) {
+    for (auto &worker : workers_) {
+      worker->proc.BindClientStream<Response, Chunk, Args...>(func_name, func);
+    }
+  }
+
+  // Calls to EXEC_POOL handlers are rejected with STATUS_OVERLOADED
+  // while max_queue_depth of them are waiting in the queue.
+  void SetWorkerPool(int num_threads, size_t max_queue_depth);
+
+  // Shed the calls to EXEC_POOL handlers early with STATUS_OVERLOADED,
+  // by a concurrency limit that adapts to the queueing delay on the
+  // pool, see AdmissionController. Set it after the worker pool.
+  void SetAdmissionControl(const AdmissionOptions &options = AdmissionOptions());
+
+  // Compress the responses of at least options.threshold bytes to the
+  // clients that have enabled it too, see Compression. Set it before Run().
+  void SetCompression(const CompressionOptions &options = CompressionOptions());
+  // The compression ratio and the cycles spent on it by all the threads.
+  CompressionStats compression_stats() const;
+
+  // The connections that send a request body longer than length are
+  // closed, 64 MiB by default. Set it before Run().
+  void SetMaxBodyLength(uint64_t length);
+
+  // The sessions of the closed connections are reused by the new ones,
+  // up to max_idle of them per thread, see SessionPool. 0 disables it.
+  void SetSessionPool(size_t max_idle);
+  // The sessions created and reused by all the threads so far.
+  size_t num_sessions_created() const;
+  size_t num_sessions_reused() const;
+
+  inline int num_threads() const { return workers_.size(); }
+
+#ifndef _WIN32
+  // Also accept connections on a unix domain socket at path,
+  // for Client::ConnectLocal(). An existing file at path is removed.
+  void ListenLocal(const std::string &path);
+#endif
+#ifdef __linux__
+  // Also accept connections of Client::ConnectShm() at path, each of
+  // them gets a shared-memory ring of ring_size bytes in each direction.
+  void ListenShm(const std::string &path, 
+                 size_t ring_size = ShmTransport::DEFAULT_RING_SIZE);
+#endif
+
+  // Only for the multi-thread mode. Run() blocks until Stop() is called,
+  // and the calling thread serves as one of the threads.
+  void Run();
+  void Stop();
+
 private:
-  asio::ip::tcp::acceptor acceptor_;
+  // Round-robin among the threads.
+  Worker *NextWorker();
+  // Start a session on the strand of the transport.
+  void StartSession(Worker *worker, std::unique_ptr<Transport> transport);
+
+  void do_accept();
+#ifndef _WIN32
+  void do_accept_local();
+#endif
+#ifdef __linux__
+  void do_accept_shm();
+#endif
+
+private:
+  std::vector<std::unique_ptr<asio::io_context>> io_contexts_; // Owned ones.
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  size_t next_worker_;
+
+  // Declared after workers_ to be destroyed before their processors,
+  // and the pool before the admission controller its tasks use.
+  std::unique_ptr<AdmissionController> admission_;
+  std::unique_ptr<ThreadPool> pool_;
+  std::unique_ptr<Compression> compression_;
 
-  Processor proc_;
+  std::unique_ptr<asio::ip::tcp::acceptor> acceptor_;
+#ifndef _WIN32
+  std::unique_ptr<asio::local::stream_protocol::acceptor> local_acceptor_;
+#endif
+#ifdef __linux__
+  std::unique_ptr<asio::local::stream_protocol::acceptor> shm_acceptor_;
+  size_t shm_ring_size_;
+#endif
 };
 
 } // namespace mrpc 
 
-#endif // MRPC_SESSION_H_
\ No newline at end of file
+#endif // MRPC_SERVER_H_
@@ -4,49 +4,401 @@
 
 namespace mrpc {
 
-void Session::do_read_header() {
-  //std::cout << "do_read_header" << std::endl;
+void Session::Recycle(size_t max_messages, size_t max_buffer) {
+  transport_.reset();
+  streams_.clear();
+  batches_.clear();
+  write_queue_.clear();
+  writing_.clear();
+  write_buffers_.clear();
+  num_pending_ = 0;
+  is_read_paused_ = false;
+  accepts_compression_ = false;
+
+  inbound_.Trim(max_buffer);
+  compress_buffer_.Trim(max_buffer);
+  if (messages_.size() > max_messages)
+    messages_.resize(max_messages);
+  free_messages_.clear();
+  for (auto &message : messages_) {
+    message->buffer().Trim(max_buffer);
+    free_messages_.push_back(message.get());
+  }
+}
+
+RpcMessage *Session::AcquireMessage() {
+  if (free_messages_.empty()) {
+    messages_.emplace_back(new RpcMessage);
+    return messages_.back().get();
+  }
+  RpcMessage *message = free_messages_.back();
+  free_messages_.pop_back();
+  return message;
+}
+
+void Session::do_read() {
+  inbound_.Compact();
+  inbound_.Reserve(READ_SIZE);
+
   auto self(shared_from_this());
-  socket_.async_read_some(asio::buffer(message_.header(), message_.header_length()),
+  transport_->async_read_some(asio::buffer(inbound_.tail(), inbound_.tail_room()),
     [this, self](std::error_code ec, std::size_t length) {
     if (!ec) {
-      message_.UnpackHeader();
-      do_read_body();
+      inbound_.Commit(length);
+      read_at_ = std::chrono::steady_clock::now();
+      do_parse();
     }
   });
 }
 
-void Session::do_read_body() {
+void Session::do_parse() {
+  while (num_pending_ < MAX_PENDING) {
+    if (inbound_.remaining() < sizeof(FrameHeader)) {
+      do_read();
+      return;
+    }
+    RpcMessage *message = AcquireMessage();
+    inbound_.Read(message->header(), message->header_length());
+    message->set_received_at(read_at_);
+    if (!message->UnpackHeader(proc_->max_body_length())) {
+      // The stream can not be resynchronized, drop the connection.
+      ReleaseMessage(message);
+      transport_->close();
+      return;
+    }
+    message->AppendBody(inbound_);
+    if (message->body_missing() > 0) {
+      do_read_body(message);
+      return;
+    }
+    if (!Inflate(message)) {
+      ReleaseMessage(message);
+      transport_->close();
+      return;
+    }
+    Dispatch(message);
+  }
+  // Resumed by do_write() after some responses have been sent.
+  is_read_paused_ = true;
+}
+
+void Session::do_read_body(RpcMessage *message) {
   auto self(shared_from_this());
-  socket_.async_read_some(asio::buffer(message_.body(), message_.body_length()),
-    [this, self](std::error_code ec, std::size_t length) {
+  // async_read keeps reading until the whole step arrives.
+  size_t length;
+  char *data = message->PrepareBody(&length);
+  transport_->async_read(asio::buffer(data, length),
+    [this, self, message, length](std::error_code ec, std::size_t /*length*/) {
     if (!ec) {
-      //if (length != message_.body_length())
-      //  std::cout << "length != message.header_length()" << std::endl;
-      proc_->Run(message_);
-      do_write_head();
+      message->CommitBody(length);
+      if (message->body_missing() > 0) {
+        do_read_body(message);
+        return;
+      }
+      if (!Inflate(message)) {
+        ReleaseMessage(message);
+        transport_->close();
+        return;
+      }
+      Dispatch(message);
+      do_parse();
     }
   });
 }
 
-void Session::do_write_head() {
+bool Session::Inflate(RpcMessage *message) {
+  Compression *compression = proc_->compression();
+  if (message->flags() & FLAG_ACCEPT_COMPRESSION) {
+    accepts_compression_ = true;
+    message->set_flags(message->flags() & ~FLAG_ACCEPT_COMPRESSION);
+  }
+  if (!(message->flags() & FLAG_COMPRESSED))
+    return true;
+  // Only sent to a server that has announced it.
+  return compression != nullptr &&
+         compression->Decompress(message, &compress_buffer_, proc_->max_body_length());
+}
+
+void Session::Dispatch(RpcMessage *message) {
+  if (message->flags() & FLAG_BATCH) {
+    DispatchBatch(message);
+    return;
+  }
+  if (message->flags() & (FLAG_STREAM | FLAG_CREDIT)) {
+    DispatchStream(message);
+    return;
+  }
+
+  num_pending_++;
   auto self(shared_from_this());
-  asio::async_write(socket_, asio::buffer(message_.header(), message_.header_length()),
-    [this, self](std::error_code ec, std::size_t /*length*/) {
-    if (!ec) {
-      do_write_body();
-    }
+  bool is_done = proc_->Run(*message, transport_->get_executor(), [this, self, message]() {
+    // Called on a pool thread, post the response back to the strand.
+    asio::post(transport_->get_executor(), [this, self, message]() { Respond(message); });
   });
+  if (is_done)
+    Respond(message);
+}
+
+void Session::DispatchStream(RpcMessage *message) {
+  uint64_t request_id = message->request_id();
+  auto iter = streams_.find(request_id);
+
+  if (message->flags() & FLAG_CREDIT) {
+    if (iter != streams_.end() && iter->second.stream->is_server_stream()) {
+      uint32_t credits = 0;
+      message->Ready4Unpack();
+      message->GetArgs(credits);
+      iter->second.credits += credits;
+      Pump(request_id);
+    }
+    ReleaseMessage(message);
+    return;
+  }
+
+  if (iter == streams_.end()) {
+    // The first frame of a call, which carries the arguments.
+    // The call is pending until its last frame is written.
+    num_pending_++;
+    Stream *stream = proc_->Open(*message);
+    if (stream == nullptr) {
+      Respond(message);
+      return;
+    }
+    StreamState &state = streams_[request_id];
+    state.stream.reset(stream);
+    state.method_id = message->method_id();
+    state.is_compact = message->is_compact();
+    state.credits = 0;
+    state.consumed = 0;
+    ReleaseMessage(message);
+
+    // Server-streaming waits for the credits from the client.
+    if (!stream->is_server_stream())
+      SendCredit(request_id, state, STREAM_WINDOW);
+    return;
+  }
+
+  // Client-streaming: a chunk, or the end.
+  StreamState &state = iter->second;
+  if (state.stream->is_server_stream()) {
+    ReleaseMessage(message);
+    return;
+  }
+  if (message->flags() & FLAG_END) {
+    message->set_flags(message->flags() & ~(FLAG_STREAM | FLAG_END));
+    message->set_status(STATUS_OK);
+    state.stream->Finish(*message);
+    streams_.erase(iter);
+    Respond(message);
+    return;
+  }
+  state.stream->Consume(*message);
+  ReleaseMessage(message);
+  if (++state.consumed >= STREAM_WINDOW / 2) {
+    SendCredit(request_id, state, state.consumed);
+    state.consumed = 0;
+  }
+}
+
+void Session::DispatchBatch(RpcMessage *message) {
+  std::vector<RpcMessage *> calls;
+  message->Ready4Unpack();
+  while (message->buffer().remaining() > 0) {
+    RpcMessage *call = AcquireMessage();
+    calls.push_back(call);
+    call->set_received_at(message->received_at());
+    if (!message->NextFrame(call)) {
+      for (auto c : calls)
+        ReleaseMessage(c);
+      ReleaseMessage(message);
+      transport_->close();
+      return;
+    }
+  }
+
+  num_pending_++;
+  uint64_t batch_id = message->request_id();
+  message->InitBatch();
+  Batch &batch = batches_[batch_id];
+  batch.response = message;
+  batch.remaining = calls.size() + 1;
+
+  auto self(shared_from_this());
+  for (auto call : calls) {
+    if (call->flags() & (FLAG_STREAM | FLAG_CREDIT | FLAG_BATCH)) {
+      std::string msg = (call->flags() & FLAG_BATCH) ? "A batch can not be nested."
+                                                     : "A streaming call can not be batched.";
+      call->set_status(STATUS_BAD_REQUEST);
+      call->set_flags(0);
+      call->Pack(msg);
+      AddToBatch(batch_id, call);
+      continue;
+    }
+    bool is_done = proc_->Run(*call, transport_->get_executor(), [this, self, batch_id, call]() {
+      asio::post(transport_->get_executor(), 
+        [this, self, batch_id, call]() { AddToBatch(batch_id, call); });
+    });
+    if (is_done)
+      AddToBatch(batch_id, call);
+  }
+  // Held until all the calls have been dispatched.
+  AddToBatch(batch_id, nullptr);
+}
+
+void Session::AddToBatch(uint64_t batch_id, RpcMessage *call) {
+  auto iter = batches_.find(batch_id);
+  Batch &batch = iter->second;
+  if (call != nullptr) {
+    batch.response->AppendFrame(*call);
+    ReleaseMessage(call);
+  }
+  if (--batch.remaining == 0) {
+    RpcMessage *response = batch.response;
+    batches_.erase(iter);
+    Respond(response);
+  }
+}
+
+void Session::Pump(uint64_t request_id) {
+  auto iter = streams_.find(request_id);
+  if (iter == streams_.end())
+    return;
+
+  StreamState &state = iter->second;
+  while (state.credits > 0) {
+    RpcMessage *chunk = AcquireMessage();
+    chunk->set_request_id(request_id);
+    chunk->set_method_id(state.method_id);
+    chunk->set_status(STATUS_OK);
+    chunk->set_flags(FLAG_STREAM);
+    chunk->set_compact(state.is_compact);
+    if (!state.stream->Next(*chunk)) {
+      chunk->set_flags(FLAG_STREAM | FLAG_END);
+      chunk->Pack();
+      streams_.erase(iter);
+      Respond(chunk);
+      return;
+    }
+    state.credits--;
+    Respond(chunk);
+  }
 }
 
-void Session::do_write_body() {
+void Session::SendCredit(uint64_t request_id, StreamState &state, uint32_t credits) {
+  RpcMessage *message = AcquireMessage();
+  message->set_request_id(request_id);
+  message->set_method_id(state.method_id);
+  message->set_status(STATUS_OK);
+  message->set_flags(FLAG_CREDIT);
+  message->set_compact(state.is_compact);
+  message->Pack(credits);
+  Respond(message);
+}
+
+void Session::Respond(RpcMessage *message) {
+  write_queue_.push_back(message);
+  if (writing_.empty())
+    do_write();
+}
+
+void Session::do_write() {
+  // Gather the headers and bodies of the queued responses into a single write.
+  Compression *compression = proc_->compression();
+  write_buffers_.clear();
+  while (!write_queue_.empty() && writing_.size() < MAX_GATHER) {
+    RpcMessage *message = write_queue_.front();
+    write_queue_.pop_front();
+    if (compression != nullptr && accepts_compression_) {
+      message->set_flags(message->flags() | FLAG_ACCEPT_COMPRESSION);
+      compression->Compress(message, &compress_buffer_);
+    }
+    writing_.push_back(message);
+    write_buffers_.push_back(asio::buffer(message->header(), message->header_length()));
+    write_buffers_.push_back(asio::buffer(message->body(), message->body_length()));
+  }
+
   auto self(shared_from_this());
-  asio::async_write(socket_, asio::buffer(message_.body(), message_.body_length()),
+  transport_->async_write(write_buffers_,
     [this, self](std::error_code ec, std::size_t /*length*/) {
-    if (!ec) {
-      do_read_header();
+    if (ec) {
+      return;
+    }
+    for (auto message : writing_) {
+      if (IsFinal(message))
+        num_pending_--;
+      ReleaseMessage(message);
     }
+    writing_.clear();
+
+    if (!write_queue_.empty())
+      do_write();
+    if (is_read_paused_ && num_pending_ < MAX_PENDING) {
+      is_read_paused_ = false;
+      do_parse();
+    }
+  });
+}
+
+SessionPool::~SessionPool() {
+  for (auto session : idle_)
+    delete session;
+}
+
+std::shared_ptr<Session> SessionPool::Acquire(std::unique_ptr<Transport> transport) {
+  Session *session = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!idle_.empty()) {
+      session = idle_.back();
+      idle_.pop_back();
+      num_reused_++;
+    }
+    else {
+      num_created_++;
+    }
+  }
+  if (session == nullptr)
+    session = new Session(std::move(transport), proc_);
+  else
+    session->transport_ = std::move(transport);
+
+  // The handlers of the sessions may be destroyed with their io_context
+  // after the pool, then the session is deleted. The deleter does not
+  // own the pool: it lives as long as the weak reference of the session
+  // to itself, which would keep an idle session and its pool alive.
+  std::weak_ptr<SessionPool> weak_pool = shared_from_this();
+  return std::shared_ptr<Session>(session, [weak_pool](Session *s) {
+    if (auto pool = weak_pool.lock())
+      pool->Release(s);
+    else
+      delete s;
   });
 }
 
-} // namespace mrpc
\ No newline at end of file
+void SessionPool::Release(Session *session) {
+  session->Recycle(KEEP_MESSAGES, KEEP_BUFFER);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (idle_.size() < max_idle_) {
+      idle_.push_back(session);
+      return;
+    }
+  }
+  delete session;
+}
+
+void SessionPool::set_max_idle(size_t max_idle) {
+  std::vector<Session *> trimmed;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_idle_ = max_idle;
+    while (idle_.size() > max_idle_) {
+      trimmed.push_back(idle_.back());
+      idle_.pop_back();
+    }
+  }
+  for (auto session : trimmed)
+    delete session;
+}
+
+} // namespace mrpc
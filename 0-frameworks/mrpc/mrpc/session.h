@@ -1,32 +1,180 @@
 #ifndef MRPC_SESSION_H_
 #define MRPC_SESSION_H_
 
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
 #include "asio.hpp"
 #include "message.h"
 #include "processor.h"
+#include "transport.h"
 
 namespace mrpc {
 
+class SessionPool;
+
+// Requests on one connection are pipelined: the next request is read
+// while the previous responses are still being written, and responses
+// are matched to requests by the request id in the frame header, so
+// they do not have to be written in the order the requests arrived.
+// The transport is expected to be on a strand, and all the handlers of a
+// session run there.
 class Session : public std::enable_shared_from_this<Session> {
+  friend class SessionPool;
+
+  // Stop reading new requests while this many have not been answered.
+  const static size_t MAX_PENDING = 1024;
+  // The maximum number of responses gathered into one write.
+  const static size_t MAX_GATHER = 64;
+  // Free space for each read from the transport.
+  const static size_t READ_SIZE = 64 * 1024;
+  // The number of chunks a client may send ahead in a client-streaming call.
+  const static uint32_t STREAM_WINDOW = 16;
+
+  // A streaming call in progress.
+  struct StreamState {
+    std::unique_ptr<Stream> stream;
+    uint32_t method_id;
+    bool is_compact;
+    // Server-streaming: the number of chunks allowed to be sent.
+    uint32_t credits;
+    // Client-streaming: chunks consumed since the last credit granted.
+    uint32_t consumed;
+  };
+
+  // A batch of calls being run, see Client::set_batching().
+  struct Batch {
+    // The request frame, reused for the batched response.
+    RpcMessage *response;
+    size_t remaining;
+  };
+
 public:
-  Session(asio::ip::tcp::socket socket, Processor *proc)
-    : socket_(std::move(socket)), proc_(proc) {}
+  Session(std::unique_ptr<Transport> transport, Processor *proc)
+    : transport_(std::move(transport)), proc_(proc), 
+      num_pending_(0), is_read_paused_(false), accepts_compression_(false) {}
+
+  inline void start() { do_read(); }
+
+private:
+  // Close the transport and drop the state of the connection, for the
+  // session to be reused by SessionPool. Keep the storage of up to
+  // max_messages messages, except the buffers beyond max_buffer bytes.
+  void Recycle(size_t max_messages, size_t max_buffer);
+
+  // Small requests are read in batches into inbound_ and then split
+  // into frames, so that a pipelined burst costs few reads.
+  void do_read();
+  void do_parse();
+  // Read the rest of a large body into the message directly.
+  void do_read_body(RpcMessage *message);
+  // Note whether the client accepts compressed responses, and restore a
+  // compressed body. Returns false if it can not be restored.
+  bool Inflate(RpcMessage *message);
+  void Dispatch(RpcMessage *message);
+
+  // Frames of the streaming calls, with the credit based flow control:
+  // a sender only sends as many chunks as the receiver has granted,
+  // so the memory is bounded by the window instead of the payload.
+  void DispatchStream(RpcMessage *message);
+  // Server-streaming: generate and queue chunks while there are credits.
+  void Pump(uint64_t request_id);
+  void SendCredit(uint64_t request_id, StreamState &state, uint32_t credits);
+
+  // Run each call of a batch frame as it is dispatched alone, and answer
+  // them in one batch frame once all of them are done. The batch counts
+  // as one pending request.
+  void DispatchBatch(RpcMessage *message);
+  void AddToBatch(uint64_t batch_id, RpcMessage *call);
+
+  // Queue a response, and start writing if there is no write in progress.
+  void Respond(RpcMessage *message);
+  void do_write();
+
+  RpcMessage *AcquireMessage();
+  inline void ReleaseMessage(RpcMessage *message) { free_messages_.push_back(message); }
 
-  inline void start() { do_read_header(); }
+  // Whether a message being written completes a request. Chunks and 
+  // credits do not, and the end of a stream does.
+  static inline bool IsFinal(const RpcMessage *message) {
+    if (message->flags() & FLAG_CREDIT)
+      return false;
+    return !(message->flags() & FLAG_STREAM) || (message->flags() & FLAG_END);
+  }
 
 private:
-  void do_read_header();
-  void do_read_body();
+  std::unique_ptr<Transport> transport_;
+  Processor *proc_;
+
+  // All the messages created by this session, and the idle ones.
+  std::vector<std::unique_ptr<RpcMessage>> messages_;
+  std::vector<RpcMessage *> free_messages_;
+
+  Buffer inbound_;
+  // When the data in inbound_ was read, the requests parsed from it
+  // count their timeouts from it.
+  std::chrono::steady_clock::time_point read_at_;
+  // Requests that have been read but whose responses are not written yet.
+  size_t num_pending_;
+  bool is_read_paused_;
+
+  std::unordered_map<uint64_t, StreamState> streams_;
+  std::unordered_map<uint64_t, Batch> batches_;
+
+  std::deque<RpcMessage *> write_queue_;
+  std::vector<RpcMessage *> writing_;
+  std::vector<asio::const_buffer> write_buffers_;
+
+  // Set once the client has marked a request with FLAG_ACCEPT_COMPRESSION.
+  bool accepts_compression_;
+  // Storage swapped with the bodies being compressed or decompressed.
+  Buffer compress_buffer_;
+};
 
-  void do_write_head();
-  void do_write_body();
+// Sessions of the closed connections are kept for the new ones, with
+// the storage of their messages and buffers, so that the short-lived
+// connections do not allocate them again. The idle sessions are trimmed
+// to high-water marks: at most max_idle of them are kept, each with at
+// most KEEP_MESSAGES messages, and the buffers that a large message has
+// grown beyond KEEP_BUFFER are freed. One pool serves the sessions of a
+// thread of the server, it is locked as the io_context of a Server may
+// be run by several threads.
+class SessionPool : public std::enable_shared_from_this<SessionPool> {
+  const static size_t KEEP_MESSAGES = 16;
+  const static size_t KEEP_BUFFER = 128 * 1024;
+
+public:
+  SessionPool(Processor *proc, size_t max_idle) 
+    : proc_(proc), max_idle_(max_idle), num_created_(0), num_reused_(0) {}
+  ~SessionPool();
+
+  // The session returns here once it is released by all its handlers.
+  std::shared_ptr<Session> Acquire(std::unique_ptr<Transport> transport);
+
+  // 0 to delete the sessions of the closed connections instead.
+  void set_max_idle(size_t max_idle);
+
+  inline size_t num_created() const { return num_created_; }
+  inline size_t num_reused() const { return num_reused_; }
 
 private:
-  asio::ip::tcp::socket socket_;
-  RpcMessage message_;
+  void Release(Session *session);
 
+private:
   Processor *proc_;
+
+  std::mutex mutex_;
+  std::vector<Session *> idle_;
+  size_t max_idle_;
+  std::atomic<size_t> num_created_;
+  std::atomic<size_t> num_reused_;
 };
 
 } // namespace mrpc
-#endif // MRPC_SESSION_H_
\ No newline at end of file
+#endif // MRPC_SESSION_H_
@@ -0,0 +1,463 @@
+#include "shm_transport.h"
+
+#ifdef __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace mrpc {
+
+namespace {
+
+const int NUM_FDS = 5; // The segment and the eventfds.
+
+void ThrowErrno(const char *what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+void CloseFds(int *fds, int num) {
+  for (int i = 0; i < num; i++) {
+    if (fds[i] >= 0)
+      ::close(fds[i]);
+  }
+}
+
+// Pass the fds with the ring capacity as the payload.
+void SendFds(int socket, uint64_t capacity, const int *fds) {
+  char control[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+  memset(control, 0, sizeof(control));
+  iovec iov = { &capacity, sizeof(capacity) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * NUM_FDS);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * NUM_FDS);
+
+  if (::sendmsg(socket, &msg, MSG_NOSIGNAL) != sizeof(capacity))
+    ThrowErrno("sendmsg");
+}
+
+void RecvFds(int socket, uint64_t *capacity, int *fds) {
+  char control[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+  iovec iov = { capacity, sizeof(*capacity) };
+  msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t length;
+  while ((length = ::recvmsg(socket, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR) {}
+  if (length < 0)
+    ThrowErrno("recvmsg");
+
+  cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (length != sizeof(*capacity) || cmsg == nullptr ||
+      cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int) * NUM_FDS)) {
+    throw std::system_error(std::make_error_code(std::errc::protocol_error),
+                            "Invalid shared memory handshake");
+  }
+  memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * NUM_FDS);
+}
+
+void Signal(int fd) {
+  uint64_t one = 1;
+  ssize_t ret = ::write(fd, &one, sizeof(one));
+  (void)ret; // Only fails if the counter is saturated, then it is signaled anyway.
+}
+
+} // namespace
+
+bool ShmRing::Used(uint64_t head, uint64_t tail, std::size_t *used) {
+  if (is_corrupted_ || head - tail > capacity_) {
+    is_corrupted_ = true;
+    return false;
+  }
+  *used = (std::size_t)(head - tail);
+  return true;
+}
+
+std::size_t ShmRing::Write(const char *data, std::size_t length) {
+  uint64_t head = header_->head.load(std::memory_order_relaxed);
+  uint64_t tail = header_->tail.load(std::memory_order_acquire);
+  std::size_t used;
+  if (!Used(head, tail, &used))
+    return 0;
+  length = std::min(length, capacity_ - used);
+
+  std::size_t offset = head & (capacity_ - 1);
+  std::size_t first = std::min(length, capacity_ - offset);
+  memcpy(data_ + offset, data, first);
+  memcpy(data_, data + first, length - first);
+  header_->head.store(head + length, std::memory_order_release);
+  return length;
+}
+
+std::size_t ShmRing::Read(char *data, std::size_t length) {
+  uint64_t tail = header_->tail.load(std::memory_order_relaxed);
+  uint64_t head = header_->head.load(std::memory_order_acquire);
+  std::size_t used;
+  if (!Used(head, tail, &used))
+    return 0;
+  length = std::min(length, used);
+
+  std::size_t offset = tail & (capacity_ - 1);
+  std::size_t first = std::min(length, capacity_ - offset);
+  memcpy(data, data_ + offset, first);
+  memcpy(data + first, data_, length - first);
+  header_->tail.store(tail + length, std::memory_order_release);
+  return length;
+}
+
+ShmTransport::ShmTransport(asio::local::stream_protocol::socket control)
+  : control_(std::move(control)), control_byte_(0), alive_(new bool(true)),
+    memory_(nullptr), memory_size_(0),
+    in_data_(control_.get_executor()), out_space_(control_.get_executor()),
+    in_data_count_(0), out_space_count_(0), in_space_fd_(-1), out_data_fd_(-1),
+    is_closed_(false), is_spinning_(std::thread::hardware_concurrency() > 1),
+    is_server_(false), is_watching_(false), is_unwatching_(false), num_waits_(0) {}
+
+ShmTransport::~ShmTransport() {
+  alive_.reset();
+  if (in_space_fd_ >= 0)
+    ::close(in_space_fd_);
+  if (out_data_fd_ >= 0)
+    ::close(out_data_fd_);
+  if (memory_ != nullptr)
+    munmap(memory_, memory_size_);
+}
+
+std::unique_ptr<ShmTransport> ShmTransport::Accept(asio::local::stream_protocol::socket control,
+                                                   std::size_t ring_size) {
+  std::size_t capacity = 4096;
+  while (capacity < ring_size)
+    capacity <<= 1;
+
+  // fds[0] is the segment, followed by the eventfds.
+  int fds[NUM_FDS];
+  std::fill(fds, fds + NUM_FDS, -1);
+  try {
+    fds[0] = memfd_create("mrpc", MFD_CLOEXEC);
+    if (fds[0] < 0)
+      ThrowErrno("memfd_create");
+    if (ftruncate(fds[0], 2 * ShmRing::MemorySize(capacity)) < 0)
+      ThrowErrno("ftruncate");
+    for (int i = 1; i < NUM_FDS; i++) {
+      fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if (fds[i] < 0)
+        ThrowErrno("eventfd");
+    }
+    SendFds(control.native_handle(), capacity, fds);
+  }
+  catch (...) {
+    CloseFds(fds, NUM_FDS);
+    throw;
+  }
+
+  std::unique_ptr<ShmTransport> transport(new ShmTransport(std::move(control)));
+  transport->Setup(fds[0], capacity, fds + 1, true);
+  transport->WatchControl();
+  return transport;
+}
+
+std::unique_ptr<ShmTransport> ShmTransport::Connect(asio::local::stream_protocol::socket control) {
+  uint64_t capacity = 0;
+  int fds[NUM_FDS];
+  RecvFds(control.native_handle(), &capacity, fds);
+  if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+    CloseFds(fds, NUM_FDS);
+    throw std::system_error(std::make_error_code(std::errc::protocol_error),
+                            "Invalid ring capacity");
+  }
+
+  std::unique_ptr<ShmTransport> transport(new ShmTransport(std::move(control)));
+  transport->Setup(fds[0], capacity, fds + 1, false);
+  return transport;
+}
+
+void ShmTransport::Setup(int memfd, std::size_t capacity, int events[NUM_EVENTS], bool is_server) {
+  memory_size_ = 2 * ShmRing::MemorySize(capacity);
+  void *memory = mmap(nullptr, memory_size_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+  // The mapping keeps the segment alive.
+  ::close(memfd);
+  if (memory == MAP_FAILED) {
+    CloseFds(events, NUM_EVENTS);
+    ThrowErrno("mmap");
+  }
+  memory_ = (char *)memory;
+  is_server_ = is_server;
+
+  // Client to server, then server to client.
+  char *c2s = memory_;
+  char *s2c = memory_ + ShmRing::MemorySize(capacity);
+  if (is_server) {
+    in_.Attach(c2s, capacity);
+    out_.Attach(s2c, capacity);
+    in_data_.assign(events[C2S_DATA]);
+    in_space_fd_ = events[C2S_SPACE];
+    out_data_fd_ = events[S2C_DATA];
+    out_space_.assign(events[S2C_SPACE]);
+  }
+  else {
+    in_.Attach(s2c, capacity);
+    out_.Attach(c2s, capacity);
+    in_data_.assign(events[S2C_DATA]);
+    in_space_fd_ = events[S2C_SPACE];
+    out_data_fd_ = events[C2S_DATA];
+    out_space_.assign(events[C2S_SPACE]);
+  }
+}
+
+bool ShmTransport::CheckRing(const ShmRing &ring) {
+  if (!ring.is_corrupted())
+    return true;
+  close();
+  return false;
+}
+
+std::size_t ShmTransport::ReadRing(asio::mutable_buffer buffer) {
+  std::size_t length = in_.Read((char *)buffer.data(), buffer.size());
+  if (!CheckRing(in_))
+    return 0;
+  if (length > 0) {
+    // Pairs with the fence of the writer between setting its flag and
+    // checking the ring again, so that one of them sees the other.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    ShmRingHeader *header = in_.header();
+    if (header->writer_waiting.load(std::memory_order_relaxed) &&
+        header->writer_waiting.exchange(0))
+      Signal(in_space_fd_);
+  }
+  return length;
+}
+
+std::size_t ShmTransport::WriteRing(const std::vector<asio::const_buffer> &buffers,
+                                    std::size_t offset) {
+  std::size_t written = 0;
+  for (const auto &buffer : buffers) {
+    if (offset >= buffer.size()) {
+      offset -= buffer.size();
+      continue;
+    }
+    std::size_t length = buffer.size() - offset;
+    std::size_t copied = out_.Write((const char *)buffer.data() + offset, length);
+    offset = 0;
+    written += copied;
+    if (copied < length)
+      break;
+  }
+  if (!CheckRing(out_))
+    return 0;
+  if (written > 0) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    ShmRingHeader *header = out_.header();
+    if (header->reader_waiting.load(std::memory_order_relaxed) &&
+        header->reader_waiting.exchange(0))
+      Signal(out_data_fd_);
+  }
+  return written;
+}
+
+void ShmTransport::async_read_some(asio::mutable_buffer buffer, Handler handler) {
+  std::size_t length = ReadRing(buffer);
+  if (length == 0 && buffer.size() > 0 && !is_closed_) {
+    ShmRingHeader *header = in_.header();
+    header->reader_waiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (in_.empty()) {
+      BeginWait();
+      // Reading the eventfd also resets it.
+      in_data_.async_read_some(asio::buffer(&in_data_count_, sizeof(in_data_count_)),
+        [this, buffer, handler](std::error_code ec, std::size_t /*length*/) {
+        if (ec) {
+          EndWait();
+          handler(ec, 0);
+          return;
+        }
+        async_read_some(buffer, handler);
+        EndWait();
+      });
+      return;
+    }
+    header->reader_waiting.store(0, std::memory_order_relaxed);
+    length = ReadRing(buffer);
+  }
+
+  std::error_code ec;
+  if (length == 0 && buffer.size() > 0)
+    ec = asio::error_code(asio::error::eof);
+  asio::post(control_.get_executor(), [handler, ec, length]() { handler(ec, length); });
+}
+
+void ShmTransport::async_write(const std::vector<asio::const_buffer> &buffers, Handler handler) {
+  do_write(buffers, 0, asio::buffer_size(buffers), std::move(handler));
+}
+
+void ShmTransport::do_write(const std::vector<asio::const_buffer> &buffers,
+                            std::size_t offset, std::size_t total, Handler handler) {
+  while (true) {
+    offset += WriteRing(buffers, offset);
+    if (offset == total || is_closed_)
+      break;
+
+    ShmRingHeader *header = out_.header();
+    header->writer_waiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (out_.full()) {
+      BeginWait();
+      out_space_.async_read_some(asio::buffer(&out_space_count_, sizeof(out_space_count_)),
+        [this, &buffers, offset, total, handler](std::error_code ec, std::size_t /*length*/) {
+        if (ec) {
+          EndWait();
+          handler(ec, offset);
+          return;
+        }
+        do_write(buffers, offset, total, handler);
+        EndWait();
+      });
+      return;
+    }
+    header->writer_waiting.store(0, std::memory_order_relaxed);
+  }
+
+  std::error_code ec;
+  if (offset < total)
+    ec = asio::error_code(asio::error::broken_pipe);
+  asio::post(control_.get_executor(), [handler, ec, offset]() { handler(ec, offset); });
+}
+
+std::size_t ShmTransport::read_some(asio::mutable_buffer buffer) {
+  if (buffer.size() == 0)
+    return 0;
+
+  while (true) {
+    std::size_t length = ReadRing(buffer);
+    if (length > 0)
+      return length;
+    if (is_closed_)
+      throw std::system_error(asio::error_code(asio::error::eof));
+    if (Spin([this]() { return !in_.empty(); }))
+      continue;
+
+    ShmRingHeader *header = in_.header();
+    header->reader_waiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (in_.empty())
+      Wait(in_data_);
+    header->reader_waiting.store(0, std::memory_order_relaxed);
+  }
+}
+
+void ShmTransport::write(const std::vector<asio::const_buffer> &buffers) {
+  std::size_t total = asio::buffer_size(buffers);
+  std::size_t offset = 0;
+  while (true) {
+    offset += WriteRing(buffers, offset);
+    if (offset == total)
+      return;
+    if (is_closed_)
+      throw std::system_error(asio::error_code(asio::error::broken_pipe));
+    if (Spin([this]() { return !out_.full(); }))
+      continue;
+
+    ShmRingHeader *header = out_.header();
+    header->writer_waiting.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (out_.full())
+      Wait(out_space_);
+    header->writer_waiting.store(0, std::memory_order_relaxed);
+  }
+}
+
+bool ShmTransport::Spin(const std::function<bool()> &is_ready) {
+  if (!is_spinning_)
+    return false;
+  for (int i = 0; i < SPIN_COUNT; i++) {
+    if (is_ready())
+      return true;
+  }
+  return false;
+}
+
+void ShmTransport::Wait(asio::posix::stream_descriptor &event) {
+  // The unix socket only becomes readable when the server closes it.
+  pollfd fds[2] = {
+    { event.native_handle(), POLLIN, 0 },
+    { control_.native_handle(), POLLIN, 0 }
+  };
+  while (::poll(fds, 2, -1) < 0 && errno == EINTR) {}
+  if (fds[1].revents != 0)
+    is_closed_ = true;
+
+  uint64_t count;
+  ssize_t ret = ::read(event.native_handle(), &count, sizeof(count));
+  (void)ret;
+}
+
+void ShmTransport::BeginWait() {
+  num_waits_++;
+  if (!is_server_ && !is_watching_)
+    WatchControl();
+}
+
+void ShmTransport::EndWait() {
+  // After the continuation, which may have started another wait.
+  if (--num_waits_ == 0 && !is_server_ && is_watching_ && !is_closed_) {
+    asio::error_code ec;
+    is_unwatching_ = true;
+    control_.cancel(ec);
+  }
+}
+
+void ShmTransport::WatchControl() {
+  is_watching_ = true;
+  std::weak_ptr<bool> alive = alive_;
+  control_.async_read_some(asio::buffer(&control_byte_, 1),
+    [this, alive](std::error_code ec, std::size_t /*length*/) {
+    if (alive.expired())
+      return;
+    is_watching_ = false;
+    if (is_closed_)
+      return;
+    if (!ec || is_unwatching_) {
+      // Nothing is expected from the peer. Cancelled by EndWait(), but
+      // another wait may have started since.
+      is_unwatching_ = false;
+      if (is_server_ || num_waits_ > 0)
+        WatchControl();
+      return;
+    }
+    is_closed_ = true;
+    // Wake up the operations waiting for the peer, they find it closed.
+    Signal(in_data_.native_handle());
+    Signal(out_space_.native_handle());
+  });
+}
+
+void ShmTransport::close() {
+  is_closed_ = true;
+  asio::error_code ec;
+  control_.close(ec);
+  in_data_.cancel(ec);
+  out_space_.cancel(ec);
+}
+
+} // namespace mrpc
+
+#endif // __linux__
@@ -0,0 +1,166 @@
+#ifndef MRPC_SHM_TRANSPORT_H_
+#define MRPC_SHM_TRANSPORT_H_
+
+#ifdef __linux__
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "transport.h"
+
+namespace mrpc {
+
+// Shared part of a single-producer single-consumer byte ring.
+// head and tail count all the bytes ever written and read. A side that
+// is going to sleep sets its waiting flag, and the other side signals
+// its eventfd after making progress only if the flag is set.
+struct ShmRingHeader {
+  alignas(64) std::atomic<uint64_t> head;
+  alignas(64) std::atomic<uint64_t> tail;
+  alignas(64) std::atomic<uint32_t> reader_waiting;
+  alignas(64) std::atomic<uint32_t> writer_waiting;
+};
+
+class ShmRing {
+public:
+  ShmRing() : header_(nullptr), data_(nullptr), capacity_(0), is_corrupted_(false) {}
+
+  // memory: MemorySize(capacity) bytes, capacity is a power of two.
+  inline void Attach(char *memory, std::size_t capacity) {
+    header_ = (ShmRingHeader *)memory;
+    data_ = memory + sizeof(ShmRingHeader);
+    capacity_ = capacity;
+  }
+  static inline std::size_t MemorySize(std::size_t capacity) {
+    return sizeof(ShmRingHeader) + capacity;
+  }
+
+  inline ShmRingHeader *header() { return header_; }
+  inline bool empty() const {
+    return header_->head.load(std::memory_order_acquire) ==
+           header_->tail.load(std::memory_order_relaxed);
+  }
+  inline bool full() const {
+    return header_->head.load(std::memory_order_relaxed) -
+           header_->tail.load(std::memory_order_acquire) == capacity_;
+  }
+
+  // Both return the number of bytes copied, which may be less than length.
+  std::size_t Write(const char *data, std::size_t length);
+  std::size_t Read(char *data, std::size_t length);
+  // head and tail are written by the peer as well. Once they are found to
+  // hold more bytes than the capacity nothing is copied any more, and the
+  // connection has to be dropped.
+  inline bool is_corrupted() const { return is_corrupted_; }
+
+private:
+  // The number of bytes in the ring, checked against the capacity.
+  bool Used(uint64_t head, uint64_t tail, std::size_t *used);
+
+  ShmRingHeader *header_;
+  char *data_;
+  std::size_t capacity_;
+  bool is_corrupted_;
+};
+
+// Transport for the processes on the same host: a ring in each direction
+// in a shared memory segment, with an eventfd to wake up a sleeping side.
+// Bytes are copied once into the ring and once out of it, and no syscall
+// is made while the other side is busy.
+//
+// The connection is set up over a unix domain socket, the server creates
+// the segment and the eventfds and passes them to the client. The socket
+// is kept open only to tell the server when the client is gone.
+class ShmTransport : public Transport {
+  const static int SPIN_COUNT = 1 << 14;
+
+public:
+  const static std::size_t DEFAULT_RING_SIZE = 1 << 20;
+
+  // Server side, for a connection accepted on the unix socket.
+  // ring_size is rounded up to a power of two.
+  static std::unique_ptr<ShmTransport> Accept(asio::local::stream_protocol::socket control,
+                                              std::size_t ring_size);
+  // Client side, for a socket connected to the server.
+  static std::unique_ptr<ShmTransport> Connect(asio::local::stream_protocol::socket control);
+
+  ~ShmTransport();
+
+  virtual asio::any_io_executor get_executor() { return control_.get_executor(); }
+
+  virtual void async_read_some(asio::mutable_buffer buffer, Handler handler);
+  virtual void async_write(const std::vector<asio::const_buffer> &buffers, Handler handler);
+
+  virtual std::size_t read_some(asio::mutable_buffer buffer);
+  virtual void write(const std::vector<asio::const_buffer> &buffers);
+
+  virtual void close();
+
+private:
+  // The eventfds in the order they are passed to the client.
+  enum EventIndex {
+    C2S_DATA = 0,
+    C2S_SPACE,
+    S2C_DATA,
+    S2C_SPACE,
+    NUM_EVENTS
+  };
+
+  ShmTransport(asio::local::stream_protocol::socket control);
+  void Setup(int memfd, std::size_t capacity, int events[NUM_EVENTS], bool is_server);
+
+  // Copy through the rings, and wake up the other side if it waits.
+  std::size_t ReadRing(asio::mutable_buffer buffer);
+  std::size_t WriteRing(const std::vector<asio::const_buffer> &buffers, std::size_t offset);
+
+  void do_write(const std::vector<asio::const_buffer> &buffers,
+                std::size_t offset, std::size_t total, Handler handler);
+  // Close the transport once the peer has closed the unix socket. The
+  // server watches it all the time. The client only while an asynchronous
+  // operation waits on an eventfd, as a pending read on it would keep
+  // io_context.run() from returning.
+  void WatchControl();
+  // Around the asynchronous waits on the eventfds.
+  void BeginWait();
+  void EndWait();
+  // Close the transport if the peer has broken the rings.
+  bool CheckRing(const ShmRing &ring);
+  // The synchronous waits. Spin a while first on multi-core machines,
+  // where the other side often answers within microseconds, then sleep
+  // on the eventfd until it is signaled or the server is gone.
+  bool Spin(const std::function<bool()> &is_ready);
+  void Wait(asio::posix::stream_descriptor &event);
+
+private:
+  asio::local::stream_protocol::socket control_;
+  char control_byte_;
+  // Checked by the handlers that may run after destruction.
+  std::shared_ptr<bool> alive_;
+
+  char *memory_;
+  std::size_t memory_size_;
+  ShmRing in_;
+  ShmRing out_;
+
+  // Waited on: data in in_, space in out_.
+  asio::posix::stream_descriptor in_data_;
+  asio::posix::stream_descriptor out_space_;
+  uint64_t in_data_count_;
+  uint64_t out_space_count_;
+  // Signaled: space in in_, data in out_.
+  int in_space_fd_;
+  int out_data_fd_;
+
+  bool is_closed_;
+  bool is_spinning_;
+  bool is_server_;
+  bool is_watching_;
+  bool is_unwatching_;
+  int num_waits_;
+};
+
+} // namespace mrpc
+
+#endif // __linux__
+#endif // MRPC_SHM_TRANSPORT_H_
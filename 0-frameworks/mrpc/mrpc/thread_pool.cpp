@@ -0,0 +1,95 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+namespace mrpc {
+
+ThreadPool::ThreadPool(int num_threads, size_t max_queue_depth)
+  : max_queue_depth_(max_queue_depth), is_stopping_(false) {
+  for (int i = 0; i < num_threads; i++) {
+    threads_.emplace_back(&ThreadPool::Entry, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    is_stopping_ = true;
+  }
+  cond_var_.notify_all();
+  for (auto &thread : threads_) {
+    thread.join();
+  }
+}
+
+bool ThreadPool::TryPost(std::function<void()> task) {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (queue_.size() >= max_queue_depth_)
+      return false;
+    queue_.push_back(std::move(task));
+  }
+  cond_var_.notify_one();
+  return true;
+}
+
+void ThreadPool::ParallelFor(size_t n, const std::function<void(size_t)> &func) {
+  struct State {
+    std::atomic<size_t> next{0};
+    std::atomic<size_t> done{0};
+    std::mutex mutex;
+    std::condition_variable cond_var;
+  };
+  if (n == 0)
+    return;
+  // Several chunks per thread, so that the uneven ones even out.
+  size_t grain = std::max<size_t>(1, n / (threads_.size() * 4 + 1));
+  // The helpers may only start after all the work is done, the state
+  // outlives this call for them, and func is not touched by them then.
+  std::shared_ptr<State> state(new State);
+  auto work = [state, n, grain, &func]() {
+    while (true) {
+      size_t begin = state->next.fetch_add(grain);
+      if (begin >= n)
+        return;
+      size_t end = std::min(begin + grain, n);
+      for (size_t i = begin; i < end; i++)
+        func(i);
+      if (state->done.fetch_add(end - begin) + (end - begin) == n) {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->cond_var.notify_all();
+      }
+    }
+  };
+
+  size_t num_helpers = std::min<size_t>(threads_.size(), (n + grain - 1) / grain - 1);
+  for (size_t i = 0; i < num_helpers; i++) {
+    if (!TryPost(work))
+      break;
+  }
+  work();
+  std::unique_lock<std::mutex> lock(state->mutex);
+  while (state->done < n)
+    state->cond_var.wait(lock);
+}
+
+void ThreadPool::Entry() {
+  while (true) {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      while (queue_.empty() && !is_stopping_)
+        cond_var_.wait(lock);
+      // The tasks left are dropped on stopping.
+      if (is_stopping_)
+        return;
+      task = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    task();
+  }
+}
+
+} // namespace mrpc
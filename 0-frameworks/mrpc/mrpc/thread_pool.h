@@ -0,0 +1,51 @@
+#ifndef MRPC_THREAD_POOL_H_
+#define MRPC_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace mrpc {
+
+// Fixed number of threads with a bounded task queue.
+class ThreadPool {
+public:
+  ThreadPool(int num_threads, size_t max_queue_depth);
+  ~ThreadPool();
+
+  // Returns false without queuing the task if the queue is full,
+  // so that the caller can reject the work instead of piling it up.
+  bool TryPost(std::function<void()> task);
+
+  // Run func(0) ... func(n - 1) on the calling thread together with the
+  // pool threads that are free to help, and return once all are done.
+  // The caller works through the indices as well instead of only waiting,
+  // so it may be called from a pool thread, and it still completes if
+  // the queue is full.
+  void ParallelFor(size_t n, const std::function<void(size_t)> &func);
+
+  inline int num_threads() const { return threads_.size(); }
+  inline size_t max_queue_depth() const { return max_queue_depth_; }
+  inline size_t queue_depth() const {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return queue_.size();
+  }
+
+private:
+  void Entry();
+
+private:
+  size_t max_queue_depth_;
+  bool is_stopping_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable cond_var_;
+  std::deque<std::function<void()>> queue_;
+  std::vector<std::thread> threads_;
+};
+
+} // namespace mrpc
+#endif // MRPC_THREAD_POOL_H_
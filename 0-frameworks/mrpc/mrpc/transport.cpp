@@ -0,0 +1,27 @@
+#include "transport.h"
+
+namespace mrpc {
+
+void Transport::async_read(asio::mutable_buffer buffer, Handler handler) {
+  do_read(buffer, 0, std::move(handler));
+}
+
+void Transport::do_read(asio::mutable_buffer buffer, std::size_t offset, Handler handler) {
+  async_read_some(buffer + offset,
+    [this, buffer, offset, handler](std::error_code ec, std::size_t length) {
+    if (ec || offset + length == buffer.size()) {
+      handler(ec, offset + length);
+      return;
+    }
+    do_read(buffer, offset + length, handler);
+  });
+}
+
+void Transport::read(asio::mutable_buffer buffer) {
+  std::size_t offset = 0;
+  while (offset < buffer.size()) {
+    offset += read_some(buffer + offset);
+  }
+}
+
+} // namespace mrpc
@@ -0,0 +1,85 @@
+#ifndef MRPC_TRANSPORT_H_
+#define MRPC_TRANSPORT_H_
+
+#include <functional>
+#include <system_error>
+#include <vector>
+
+#include "asio.hpp"
+
+namespace mrpc {
+
+// A byte stream between a client and a server, which carries the frames.
+// Session and Client only talk to this interface, so the same Bind/Call
+// API runs over TCP, a unix domain socket or a shared-memory ring.
+//
+// The asynchronous operations follow the asio rules: the handler is never
+// called from inside the initiating function, at most one read and one
+// write can be in progress, and the buffers (including the vector of
+// buffers) have to stay valid until the handler is called.
+// The synchronous ones throw std::system_error on failure.
+class Transport {
+public:
+  typedef std::function<void(std::error_code, std::size_t)> Handler;
+
+  virtual ~Transport() {}
+
+  virtual asio::any_io_executor get_executor() = 0;
+
+  virtual void async_read_some(asio::mutable_buffer buffer, Handler handler) = 0;
+  // Read the whole buffer.
+  virtual void async_read(asio::mutable_buffer buffer, Handler handler);
+  // Write all the buffers.
+  virtual void async_write(const std::vector<asio::const_buffer> &buffers, Handler handler) = 0;
+
+  virtual std::size_t read_some(asio::mutable_buffer buffer) = 0;
+  virtual void read(asio::mutable_buffer buffer);
+  virtual void write(const std::vector<asio::const_buffer> &buffers) = 0;
+
+  virtual void close() = 0;
+
+private:
+  void do_read(asio::mutable_buffer buffer, std::size_t offset, Handler handler);
+};
+
+// TCP or unix domain socket.
+template <typename Socket>
+class SocketTransport : public Transport {
+public:
+  SocketTransport(Socket socket) : socket_(std::move(socket)) {}
+
+  inline Socket &socket() { return socket_; }
+
+  virtual asio::any_io_executor get_executor() { return socket_.get_executor(); }
+
+  virtual void async_read_some(asio::mutable_buffer buffer, Handler handler) {
+    socket_.async_read_some(buffer, std::move(handler));
+  }
+  virtual void async_read(asio::mutable_buffer buffer, Handler handler) {
+    asio::async_read(socket_, buffer, std::move(handler));
+  }
+  virtual void async_write(const std::vector<asio::const_buffer> &buffers, Handler handler) {
+    asio::async_write(socket_, buffers, std::move(handler));
+  }
+
+  virtual std::size_t read_some(asio::mutable_buffer buffer) { return socket_.read_some(buffer); }
+  virtual void read(asio::mutable_buffer buffer) { asio::read(socket_, buffer); }
+  virtual void write(const std::vector<asio::const_buffer> &buffers) { asio::write(socket_, buffers); }
+
+  virtual void close() {
+    asio::error_code ec;
+    socket_.close(ec);
+  }
+
+private:
+  Socket socket_;
+};
+
+typedef SocketTransport<asio::ip::tcp::socket> TcpTransport;
+#ifndef _WIN32
+typedef SocketTransport<asio::local::stream_protocol::socket> LocalTransport;
+#endif
+
+} // namespace mrpc
+
+#endif // MRPC_TRANSPORT_H_